@@ -1,1500 +1,6923 @@
 #include <SFML/Graphics.hpp>
-#include <iostream>
+#include <string>
 #include <ctime>
 #include <cstdlib>
+#include <cstdio>
+#include <cstdarg>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <memory>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <sstream>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace sf;
 using namespace std;
 
-class TextureLoader {
+// Highest level that is compiled in: 0=error, 1=warn, 2=info, 3=debug.
+// Calls above it expand to nothing, arguments included.
+#ifndef MAGICKA_LOG_LEVEL
+#define MAGICKA_LOG_LEVEL 2
+#endif
+
+class Log {
 public:
-    static const int FRAME_WIDTH = 32;
-    static const int FRAME_HEIGHT = 32;
-    static const int FRAME_COUNT = 10;
+    enum Level { Error, Warn, Info, Debug };
+    enum Category { Assets, Combat, Cards, Game };
 
-    static bool load(Texture& texture, const string& filename) {
-        if (!texture.loadFromFile(filename)) {
-            cerr << "Failed to load texture: " << filename << endl;
-            return false;
+private:
+    static const int MESSAGE_SIZE = 120;
+    static const unsigned RING_SIZE = 256; // power of two
+
+    struct Record {
+        long long micros;
+        unsigned char level;
+        unsigned char category;
+        char text[MESSAGE_SIZE];
+    };
+
+    // Single-producer/single-consumer ring: the owning thread pushes, the drain thread pops.
+    struct Ring {
+        Record records[RING_SIZE];
+        atomic<unsigned> head;
+        atomic<unsigned> tail;
+        atomic<bool> retired; // Owning thread has exited
+        Ring* next; // Changed only by the drain thread once linked
+
+        Ring() : head(0), tail(0), retired(false), next(nullptr) {}
+    };
+
+    // Hands the ring back to the drain thread when its thread exits.
+    struct RingOwner {
+        Ring* ring;
+
+        RingOwner() : ring(nullptr) {}
+        ~RingOwner() {
+            if (ring) ring->retired.store(true, memory_order_release);
         }
-        return true;
+    };
+
+    static atomic<Ring*>& rings() {
+        static atomic<Ring*> list(nullptr);
+        return list;
     }
 
-    static IntRect getFrameRect(int frameIndex) {
-        return IntRect(frameIndex * FRAME_WIDTH, 0, FRAME_WIDTH, FRAME_HEIGHT);
+    static atomic<bool>& running() {
+        static atomic<bool> flag(false);
+        return flag;
     }
-};
 
-class Player {
-private:
-    int HP;
-    int coins;
-    int maxHP;
-    int powerBoost;
-    int powerDuration;
-    int currentMana;
-    int maxMana;
-    Sprite sprite;
-    Texture standingTexture;
-    Texture dyingTexture;
-    int currentFrame;
-    int state; // 0=standing, 1=attacking, 2=dying
-    Clock frameClock;
+    static atomic<unsigned>& dropped() {
+        static atomic<unsigned> count(0);
+        return count;
+    }
 
-public:
-    Player() : HP(25), coins(100), maxHP(25), powerBoost(0), powerDuration(0), currentMana(5), maxMana(5),
-        currentFrame(0), state(0) {
-        if (TextureLoader::load(standingTexture, "player standing.png") &&
-            TextureLoader::load(dyingTexture, "player dying.png")) {
-            sprite.setTexture(standingTexture);
-            sprite.setTextureRect(TextureLoader::getFrameRect(0));
-        }
-        sprite.setScale(2.f, 2.f);
+    static thread*& drainThread() {
+        static thread* worker = nullptr;
+        return worker;
     }
 
-    int getHP() const { return HP; }
-    int getCoins() const { return coins; }
-    int getPowerBoost() const { return powerBoost; }
-    int getPowerDuration() const { return powerDuration; }
-    void decHP() { HP--; }
-    void buy(int cardVal) { coins -= cardVal; }
-    void takeDMG(int val) {
-        HP -= val;
-        if (HP <= 0) state = 2;
+    static FILE*& output() {
+        static FILE* file = nullptr;
+        return file;
     }
-    void heal(int val) {
-        HP = HP + val;
-        if (HP > maxHP) HP = maxHP;
+
+    static chrono::steady_clock::time_point startTime() {
+        static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        return start;
     }
-    void increaseCoins(int val) { coins += val; }
-    void setPowerBoost(int val) { powerBoost = val; }
-    void setPowerDuration(int val) { powerDuration = val; }
-    void decrementPowerDuration() { if (powerDuration > 0) powerDuration--; }
-    int getCurrentMana() const { return currentMana; }
-    int getMaxMana() const { return maxMana; }
-    void spendMana(int amount) { currentMana -= amount; }
-    void resetMana() { currentMana = maxMana; }
-    void increaseMaxMana(int amount) { maxMana += amount; }
-    int getMaxHP() { return maxHP; }
-    void setMaxHP(int val) { maxHP = val; }
-    void setMaxMana(int val) { maxMana = val; }
-    void setCurrentMana(int val) { currentMana = val; }
 
-    void updateSprite(float deltaTime) {
-        if (frameClock.getElapsedTime().asSeconds() > 0.1f) {
-            if (state == 2) { // Dying
-                sprite.setTexture(dyingTexture);
-                if (currentFrame < TextureLoader::FRAME_COUNT - 1) {
-                    currentFrame++;
-                }
+    // Each thread gets its own ring on first use; rings are linked lock-free and
+    // freed by the drain thread once their thread has exited and they are empty.
+    static Ring* threadRing() {
+        thread_local RingOwner owner;
+        if (!owner.ring) {
+            Ring* ring = new Ring();
+            Ring* first = rings().load(memory_order_relaxed);
+            do {
+                ring->next = first;
+            } while (!rings().compare_exchange_weak(first, ring, memory_order_release, memory_order_relaxed));
+            owner.ring = ring;
+        }
+        return owner.ring;
+    }
+
+    static bool finished(Ring* ring) {
+        return ring->retired.load(memory_order_acquire) &&
+            ring->tail.load(memory_order_relaxed) == ring->head.load(memory_order_acquire);
+    }
+
+    // Drain thread only. New rings are pushed at the front, so the front is
+    // unlinked with a compare-exchange and the rest by plain pointer updates.
+    static void freeRetired() {
+        Ring* ring = rings().load(memory_order_acquire);
+        while (ring && finished(ring)) {
+            Ring* next = ring->next;
+            if (rings().compare_exchange_strong(ring, next, memory_order_acq_rel, memory_order_acquire)) {
+                delete ring;
+                ring = next;
             }
-            else { // Standing
-                sprite.setTexture(standingTexture);
-                currentFrame = (currentFrame + 1) % TextureLoader::FRAME_COUNT;
+        }
+        if (!ring) return;
+
+        Ring* previous = ring;
+        while (Ring* current = previous->next) {
+            if (finished(current)) {
+                previous->next = current->next;
+                delete current;
+            }
+            else {
+                previous = current;
             }
-            sprite.setTextureRect(TextureLoader::getFrameRect(currentFrame));
-            frameClock.restart();
         }
     }
 
-    Sprite& getSprite() { return sprite; }
-    bool isAlive() const { return HP > 0; }
-};
-
-class Enemy {
-protected:
-    int HP;
-    bool alive;
-    int exhaustValue;
-    int exhaustDuration;
-    int enemyType; // 0 = cronie, 1 = captain, 2 = boss
-    Sprite sprite;
-    Texture standingTexture;
-    Texture dyingTexture;
-    int currentFrame;
-    int state; // 0=standing, 1=attacking, 2=dying, 3=healing
-    Clock frameClock;
+    static const char* levelName(int level) {
+        static const char* names[] = { "ERROR", "WARN ", "INFO ", "DEBUG" };
+        return names[level];
+    }
 
-public:
-    Enemy() : HP(10), alive(true), exhaustValue(0), exhaustDuration(0), enemyType(0),
-        currentFrame(0), state(0) {
+    static const char* categoryName(int category) {
+        static const char* names[] = { "assets", "combat", "cards", "game" };
+        return names[category];
     }
 
-    int getHP() const { return HP; }
-    void setHP(int val) { HP = val; }
-    bool isAlive() const { return alive; }
-    void setAlive(bool status) { alive = status; }
-    int getEnemyType() const { return enemyType; }
-    virtual void takeDMG(int val) {
-        HP -= val;
-        if (HP <= 0) {
-            alive = false;
-            state = 2; // Dying state
+    static bool drainOnce() {
+        bool wroteAny = false;
+        FILE* out = output() ? output() : stderr;
+        for (Ring* ring = rings().load(memory_order_acquire); ring; ring = ring->next) {
+            unsigned tail = ring->tail.load(memory_order_relaxed);
+            unsigned head = ring->head.load(memory_order_acquire);
+            while (tail != head) {
+                const Record& record = ring->records[tail & (RING_SIZE - 1)];
+                fprintf(out, "[%8.3f] %s %-6s %s\n", record.micros / 1000000.0,
+                    levelName(record.level), categoryName(record.category), record.text);
+                ++tail;
+                wroteAny = true;
+            }
+            ring->tail.store(tail, memory_order_release);
+        }
+
+        unsigned lost = dropped().exchange(0, memory_order_relaxed);
+        if (lost > 0) {
+            fprintf(out, "[log] %u messages dropped (ring full)\n", lost);
+            wroteAny = true;
         }
+        if (wroteAny) fflush(out);
+        freeRetired();
+        return wroteAny;
     }
-    virtual void attack(Player& player) = 0;
-    virtual void updateSprite(float deltaTime) {
-        if (frameClock.getElapsedTime().asSeconds() > 0.1f) {
-            if (state == 2) { // Dying
-                sprite.setTexture(dyingTexture);
-                if (currentFrame < TextureLoader::FRAME_COUNT - 1) {
-                    currentFrame++;
-                }
-            }
-            else { // Standing
-                sprite.setTexture(standingTexture);
-                currentFrame = (currentFrame + 1) % TextureLoader::FRAME_COUNT;
+
+    static void drainLoop() {
+        while (running().load(memory_order_acquire)) {
+            if (!drainOnce()) {
+                this_thread::sleep_for(chrono::milliseconds(5));
             }
-            sprite.setTextureRect(TextureLoader::getFrameRect(currentFrame));
-            frameClock.restart();
         }
+        drainOnce();
     }
-    Sprite& getSprite() { return sprite; }
 
-    virtual ~Enemy() {}
-};
-
-class Cronie : public Enemy {
 public:
-    Cronie() {
-        setHP(5);
-        enemyType = 0;
-        cout << "Cronie Deployed" << endl;
-        if (TextureLoader::load(standingTexture, "Cronies Standing.png") &&
-            TextureLoader::load(dyingTexture, "Cronies Dying.png")) {
-            sprite.setTexture(standingTexture);
-            sprite.setTextureRect(TextureLoader::getFrameRect(0));
+    // Starts the background drain; an empty path writes to stderr.
+    static void start(const string& path = "") {
+        if (running().exchange(true)) return;
+        startTime();
+        if (!path.empty()) {
+            output() = fopen(path.c_str(), "w");
         }
-        sprite.setScale(2.f, 2.f);
-        sprite.setOrigin(TextureLoader::FRAME_WIDTH / 2, TextureLoader::FRAME_HEIGHT / 2);
-        sprite.setScale(-2.f, 2.f); // Flip horizontally
+        drainThread() = new thread(drainLoop);
     }
 
-    void attack(Player& player) override {
-        player.decHP();
-        state = 1; // Attacking state
+    static void stop() {
+        if (!running().exchange(false)) return;
+        drainThread()->join();
+        delete drainThread();
+        drainThread() = nullptr;
+        if (output()) {
+            fclose(output());
+            output() = nullptr;
+        }
     }
 
-    void updateSprite(float deltaTime) override {
-        Enemy::updateSprite(deltaTime);
+    // Formats into the calling thread's ring. Never blocks: a full ring drops the message.
+    static void write(Level level, Category category, const char* format, ...) {
+        Ring* ring = threadRing();
+        unsigned head = ring->head.load(memory_order_relaxed);
+        if (head - ring->tail.load(memory_order_acquire) >= RING_SIZE) {
+            dropped().fetch_add(1, memory_order_relaxed);
+            return;
+        }
+
+        Record& record = ring->records[head & (RING_SIZE - 1)];
+        record.micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime()).count();
+        record.level = (unsigned char)level;
+        record.category = (unsigned char)category;
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(record.text, MESSAGE_SIZE, format, args);
+        va_end(args);
+
+        ring->head.store(head + 1, memory_order_release);
     }
 };
 
-class Captain : public Enemy {
-public:
-    Captain() {
-        setHP(7);
-        enemyType = 1;
-        cout << "Captain Deployed" << endl;
-        if (TextureLoader::load(standingTexture, "Captain Standing.png") &&
-            TextureLoader::load(dyingTexture, "Captain Dying.png")) {
-            sprite.setTexture(standingTexture);
-            sprite.setTextureRect(TextureLoader::getFrameRect(0));
-        }
-        sprite.setScale(2.f, 2.f);
-        sprite.setOrigin(TextureLoader::FRAME_WIDTH / 2, TextureLoader::FRAME_HEIGHT / 2);
-        sprite.setScale(-2.f, 2.f); // Flip horizontally
+#if MAGICKA_LOG_LEVEL >= 0
+#define LOG_ERROR(category, ...) Log::write(Log::Error, category, __VA_ARGS__)
+#else
+#define LOG_ERROR(category, ...) ((void)0)
+#endif
+#if MAGICKA_LOG_LEVEL >= 1
+#define LOG_WARN(category, ...) Log::write(Log::Warn, category, __VA_ARGS__)
+#else
+#define LOG_WARN(category, ...) ((void)0)
+#endif
+#if MAGICKA_LOG_LEVEL >= 2
+#define LOG_INFO(category, ...) Log::write(Log::Info, category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...) ((void)0)
+#endif
+#if MAGICKA_LOG_LEVEL >= 3
+#define LOG_DEBUG(category, ...) Log::write(Log::Debug, category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...) ((void)0)
+#endif
+
+// Startup phase timing. Phases are marked on the main thread; the render thread
+// marks the first presented frame. Time-to-interactive is when the first run can
+// start without loading anything.
+class StartupTrace {
+private:
+    static chrono::steady_clock::time_point& origin() {
+        static chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        return start;
     }
 
-    void attack(Player& player) override {
-        int dmg = rand() % 3;
-        player.takeDMG(dmg);
-        state = 1; // Attacking state
-    }
+    static double& lastMark() { static double last = 0.0; return last; }
+    static atomic<bool>& firstFrameSeen() { static atomic<bool> seen(false); return seen; }
 
-    void updateSprite(float deltaTime) override {
-        Enemy::updateSprite(deltaTime);
+    static double elapsedMs() {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - origin()).count();
     }
-};
 
-class Boss : public Enemy {
 public:
-    Boss() {
-        setHP(15);
-        enemyType = 2;
-        cout << "Boss Deployed" << endl;
-        if (TextureLoader::load(standingTexture, "Boss Standing.png") &&
-            TextureLoader::load(dyingTexture, "Boss Dying.png")) {
-            sprite.setTexture(standingTexture);
-            sprite.setTextureRect(TextureLoader::getFrameRect(0));
-        }
-        sprite.setScale(2.f, 2.f);
-        sprite.setOrigin(TextureLoader::FRAME_WIDTH / 2, TextureLoader::FRAME_HEIGHT / 2);
-        sprite.setScale(-2.f, 2.f); // Flip horizontally
+    static void begin() {
+        origin() = chrono::steady_clock::now();
+        lastMark() = 0.0;
     }
 
-    void attack(Player& player) override {
-        int dmg = rand() % 5;
-        player.takeDMG(dmg);
-        state = 1; // Attacking state
+    static void phase(const char* name) {
+        double now = elapsedMs();
+        LOG_INFO(Log::Game, "Startup: %-12s %7.1f ms (at %7.1f ms)", name, now - lastMark(), now);
+        lastMark() = now;
     }
 
-    void heal() {
-        if (rand() % 6 > 2) {
-            setHP(getHP() + 2);
-            state = 3; // Healing state
-        }
+    static bool hasFirstFrame() { return firstFrameSeen().load(memory_order_acquire); }
+
+    static void firstFrame() {
+        if (firstFrameSeen().exchange(true)) return;
+        LOG_INFO(Log::Game, "Startup: time to first frame %.1f ms", elapsedMs());
     }
 
-    void updateSprite(float deltaTime) override {
-        Enemy::updateSprite(deltaTime);
+    static void interactive() {
+        LOG_INFO(Log::Game, "Startup: time to interactive %.1f ms", elapsedMs());
     }
 };
 
-class Card {
-protected:
-    bool AOE;
-    int cardID;
-    bool isUnlocked;
-    Texture texture;
-    Sprite sprite;
+// Allocation tracking, compiled in with -DMAGICKA_ALLOC_TRACKING. Global
+// new/delete count calls and bytes on threads that have opted in (the game
+// thread, once its first frame starts), attributed to the innermost
+// ALLOC_ZONE. Steady-state frames (no input for a while) should not allocate
+// at all; any that do are reported with their zones.
+#ifdef MAGICKA_ALLOC_TRACKING
+class AllocTracker {
 public:
-    Card() : AOE(false), cardID(0), isUnlocked(false) {
-        sprite.setScale(2.f, 2.f);
-    }
+    static const int MAX_ZONES = 32;
+    static const int REPORT_LIMIT = 20; // Steady-frame warnings per run
 
-    bool isAOE() const { return AOE; }
-    int getID() const { return cardID; }
-    bool getUnlockStatus() const { return isUnlocked; }
-    void setAOE(bool val) { AOE = val; }
-    void setID(int val) { cardID = val; }
-    void unlockCard() { isUnlocked = true; }
-    Sprite& getSprite() { return sprite; }
+    struct Zone {
+        const char* name;
+        Uint64 count;
+        Uint64 bytes;
+    };
+
+private:
+    struct ThreadState {
+        bool tracking;
+        int zone;
+        Uint64 frameCount;
+        Uint64 frameBytes;
+        Zone zones[MAX_ZONES]; // Counts for the current frame
+        int zoneCount;
+    };
 
-    virtual void play(Player* player, Enemy** enemies, int enemyCount) {
-        cout << "Base card played (does nothing)\n";
+    static ThreadState& local() {
+        thread_local ThreadState state = ThreadState();
+        return state;
     }
 
-    virtual ~Card() {}
-};
+    static atomic<Uint64>& badFrames() { static atomic<Uint64> frames(0); return frames; }
 
-class SlashCard : public Card {
-private:
-    static int attack;
 public:
-    SlashCard() {
-        setID(0);
-        unlockCard();
-        if (TextureLoader::load(texture, "Slash.png")) {
-            sprite.setTexture(texture);
+    static void onAllocate(size_t size) {
+        ThreadState& state = local();
+        if (!state.tracking) return;
+        state.frameCount++;
+        state.frameBytes += size;
+        state.zones[state.zone].count++;
+        state.zones[state.zone].bytes += size;
+    }
+
+    // Zones are looked up by name pointer, so pass string literals.
+    static int enterZone(const char* name) {
+        ThreadState& state = local();
+        int previous = state.zone;
+        int index = 0;
+        while (index < state.zoneCount && state.zones[index].name != name) index++;
+        if (index == state.zoneCount) {
+            if (state.zoneCount == MAX_ZONES) return previous;
+            state.zones[index].name = name;
+            state.zoneCount++;
         }
+        state.zone = index;
+        return previous;
     }
 
-    static void upgrade() { ++attack; }
+    static void leaveZone(int previous) { local().zone = previous; }
 
-    void play(Player* player, Enemy** enemies, int enemyCount) override {
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i]->isAlive()) {
-                slashing(*enemies[i]);
-                break;
-            }
+    class Scope {
+    private:
+        int previous;
+    public:
+        explicit Scope(const char* name) : previous(enterZone(name)) {}
+        ~Scope() { leaveZone(previous); }
+    };
+
+    static void beginFrame() {
+        ThreadState& state = local();
+        if (state.zoneCount == 0) {
+            state.zones[0].name = "untracked zone";
+            state.zoneCount = 1;
+        }
+        for (int i = 0; i < state.zoneCount; i++) {
+            state.zones[i].count = state.zones[i].bytes = 0;
         }
+        state.frameCount = state.frameBytes = 0;
+        state.zone = 0;
+        state.tracking = true;
     }
 
-    void slashing(Enemy& enemy) const {
-        if (enemy.isAlive()) enemy.takeDMG(attack);
+    static void endFrame(const char* loop, bool steady) {
+        ThreadState& state = local();
+        state.tracking = false;
+        if (!steady || state.frameCount == 0) return;
+
+        Uint64 seen = badFrames().fetch_add(1);
+        if (seen >= REPORT_LIMIT) return;
+        LOG_WARN(Log::Game, "%s: steady frame made %llu allocations (%llu bytes)", loop,
+            (unsigned long long)state.frameCount, (unsigned long long)state.frameBytes);
+        for (int i = 0; i < state.zoneCount; i++) {
+            if (state.zones[i].count) {
+                LOG_WARN(Log::Game, "    %-28s %llu (%llu bytes)", state.zones[i].name,
+                    (unsigned long long)state.zones[i].count, (unsigned long long)state.zones[i].bytes);
+            }
+        }
     }
+
+    static Uint64 steadyFramesThatAllocated() { return badFrames().load(); }
 };
-int SlashCard::attack = 3;
 
-class HealCard : public Card {
-private:
-    static int healing;
+// GCC pairs operator new with free() once the replacements inline and
+// reports a mismatch; they are a matched malloc/free pair.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static void* trackedAllocate(size_t size) {
+    AllocTracker::onAllocate(size);
+    return malloc(size ? size : 1);
+}
+static void trackedRelease(void* memory) { free(memory); }
+
+void* operator new(size_t size) {
+    void* memory = trackedAllocate(size);
+    if (!memory) throw bad_alloc();
+    return memory;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return trackedAllocate(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return trackedAllocate(size); }
+void operator delete(void* memory) noexcept { trackedRelease(memory); }
+void operator delete[](void* memory) noexcept { trackedRelease(memory); }
+void operator delete(void* memory, size_t) noexcept { trackedRelease(memory); }
+void operator delete[](void* memory, size_t) noexcept { trackedRelease(memory); }
+void operator delete(void* memory, const nothrow_t&) noexcept { trackedRelease(memory); }
+void operator delete[](void* memory, const nothrow_t&) noexcept { trackedRelease(memory); }
+
+#define ALLOC_ZONE_NAME2(line) allocZone##line
+#define ALLOC_ZONE_NAME(line) ALLOC_ZONE_NAME2(line)
+#define ALLOC_ZONE(name) AllocTracker::Scope ALLOC_ZONE_NAME(__LINE__)(name)
+#define ALLOC_FRAME_BEGIN() AllocTracker::beginFrame()
+#define ALLOC_FRAME_END(loop, steady) AllocTracker::endFrame(loop, steady)
+#else
+#define ALLOC_ZONE(name) ((void)0)
+#define ALLOC_FRAME_BEGIN() ((void)0)
+#define ALLOC_FRAME_END(loop, steady) ((void)(steady))
+#endif
+
+// Read-only view of assets.pak: every image under Files/ pre-decoded to RGBA plus
+// the raw font files, looked up by a case-insensitive path hash. The file is
+// memory-mapped, so textures upload straight from the mapping with no decoding.
+class AssetPack {
 public:
-    HealCard() {
-        setID(1);
-        unlockCard();
-        if (TextureLoader::load(texture, "HEAL.png")) {
-            sprite.setTexture(texture);
-        }
-    }
+    // TILES entries carry only the full size; the pixels are in per-tile IMAGE entries.
+    enum EntryType { IMAGE = 1, FONT = 2, TILES = 3 };
 
-    static void upgrade() { ++healing; }
+    struct Header {
+        char magic[8];
+        Uint32 version;
+        Uint32 entryCount;
+    };
 
-    void play(Player* player, Enemy** enemies, int enemyCount) override {
-        heal(*player);
-    }
+    struct Entry {
+        Uint64 pathHash;
+        Uint32 type;
+        Uint32 width;
+        Uint32 height;
+        Uint32 reserved;
+        Uint64 offset;
+        Uint64 size;
+    };
 
-    void heal(Player& player) { player.heal(healing); }
-};
-int HealCard::healing = 2;
+    static const Uint32 VERSION = 1;
 
-class DrainCard : public Card {
 private:
-    static int drainAttack, drainHealing;
+    const unsigned char* base;
+    size_t mappedSize;
+    const Entry* entries;
+    Uint32 entryCount;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+
+    AssetPack() : base(nullptr), mappedSize(0), entries(nullptr), entryCount(0) {
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = nullptr;
+#else
+        fileDescriptor = -1;
+#endif
+    }
+
+    bool map(const string& path) {
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        GetFileSizeEx(fileHandle, &size);
+        mappedSize = (size_t)size.QuadPart;
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mappingHandle) return false;
+        base = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        return base != nullptr;
+#else
+        fileDescriptor = ::open(path.c_str(), O_RDONLY);
+        if (fileDescriptor < 0) return false;
+        struct stat info;
+        if (fstat(fileDescriptor, &info) != 0) return false;
+        mappedSize = (size_t)info.st_size;
+        void* mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapping == MAP_FAILED) return false;
+        base = (const unsigned char*)mapping;
+        return true;
+#endif
+    }
+
+    // Data inside the mapping, and image pixels that match the stated size.
+    bool valid(const Entry& entry) const {
+        if (entry.offset > mappedSize || entry.size > mappedSize - entry.offset) return false;
+        switch (entry.type) {
+        case IMAGE: return entry.size == (Uint64)entry.width * entry.height * 4;
+        case FONT:
+        case TILES: return true;
+        default: return false;
+        }
+    }
+
 public:
-    DrainCard() {
-        setID(2);
-        if (TextureLoader::load(texture, "Drain.png")) {
-            sprite.setTexture(texture);
+    static AssetPack& instance() {
+        static AssetPack pack;
+        return pack;
+    }
+
+    ~AssetPack() {
+        close();
+    }
+
+    // Lower-cased, forward slashes, no leading "./", so "slash.png" finds Slash.png.
+    static Uint64 hashPath(const string& path) {
+        size_t start = (path.compare(0, 2, "./") == 0) ? 2 : 0;
+        Uint64 hash = 14695981039346656037ULL; // FNV-1a
+        for (size_t i = start; i < path.size(); i++) {
+            char c = path[i] == '\\' ? '/' : (char)tolower((unsigned char)path[i]);
+            hash ^= (unsigned char)c;
+            hash *= 1099511628211ULL;
         }
+        return hash;
     }
 
-    static void upgrade() { ++drainAttack; ++drainHealing; }
+    bool open(const string& path) {
+        close();
+        if (!map(path)) {
+            close();
+            return false;
+        }
+
+        const Header* header = (const Header*)base;
+        if (mappedSize < sizeof(Header) || memcmp(header->magic, "MAGPACK", 8) != 0) {
+            LOG_WARN(Log::Assets, "%s is not an asset pack", path.c_str());
+            close();
+            return false;
+        }
+        if (header->version != VERSION) {
+            LOG_WARN(Log::Assets, "%s is pack version %u, expected %u; rebuild it with --pack", path.c_str(), header->version, VERSION);
+            close();
+            return false;
+        }
 
-    void play(Player* player, Enemy** enemies, int enemyCount) override {
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i]->isAlive()) {
-                lifeSteal(*enemies[i], *player);
-                break;
+        if ((mappedSize - sizeof(Header)) / sizeof(Entry) < header->entryCount) {
+            LOG_WARN(Log::Assets, "%s is truncated; rebuild it with --pack", path.c_str());
+            close();
+            return false;
+        }
+        const Entry* table = (const Entry*)(base + sizeof(Header));
+        for (Uint32 i = 0; i < header->entryCount; i++) {
+            if (!valid(table[i]) || (i > 0 && table[i].pathHash < table[i - 1].pathHash)) {
+                LOG_WARN(Log::Assets, "%s: entry %u is corrupt; rebuild it with --pack", path.c_str(), i);
+                close();
+                return false;
             }
         }
+
+        entries = table;
+        entryCount = header->entryCount;
+        LOG_INFO(Log::Assets, "Mapped %s: %u assets, %.1f MB", path.c_str(), entryCount, mappedSize / 1048576.0);
+        return true;
     }
 
-    void lifeSteal(Enemy& enemy, Player& player) {
-        enemy.takeDMG(drainAttack);
-        player.heal(drainHealing);
+    void close() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (base) munmap((void*)base, mappedSize);
+        if (fileDescriptor >= 0) ::close(fileDescriptor);
+        fileDescriptor = -1;
+#endif
+        base = nullptr;
+        mappedSize = 0;
+        entries = nullptr;
+        entryCount = 0;
     }
-};
-int DrainCard::drainAttack = 2;
-int DrainCard::drainHealing = 1;
 
-class Inquisition : public Card {
-private:
-    static int INattack;
-public:
-    Inquisition() {
-        setAOE(true);
-        setID(3);
-        if (TextureLoader::load(texture, "Inquisition.png")) {
-            sprite.setTexture(texture);
+    bool isOpen() const { return base != nullptr; }
+
+    // Entries are sorted by hash when the pack is written.
+    const Entry* find(const string& path) const {
+        if (!entries) return nullptr;
+        Uint64 hash = hashPath(path);
+        Uint32 low = 0, high = entryCount;
+        while (low < high) {
+            Uint32 mid = (low + high) / 2;
+            if (entries[mid].pathHash < hash) low = mid + 1;
+            else high = mid;
         }
+        if (low < entryCount && entries[low].pathHash == hash) return &entries[low];
+        return nullptr;
     }
 
-    static void upgrade() { INattack++; }
+    // open() has checked that the entry's bytes lie inside the mapping.
+    const unsigned char* data(const Entry& entry) const { return base + entry.offset; }
+};
+
+class TextureLoader {
+public:
+    static const int FRAME_COUNT = 10; // Frames per character sheet, laid out in one row
+
+    // Any thread. Leaves the image empty when the asset pack has the pixels
+    // ready, so upload() reads them straight from the mapping.
+    static bool decode(Image& image, const string& filename) {
+        const AssetPack::Entry* entry = AssetPack::instance().find(filename);
+        if (entry && entry->type == AssetPack::IMAGE) return true;
+        return image.loadFromFile(filename);
+    }
 
-    void play(Player* player, Enemy** enemies, int enemyCount) override {
-        inquisition(enemies, enemyCount);
+    // Game thread: the GL side of a load, from the decoded image or the pack.
+    static bool upload(Texture& texture, const Image& image, const string& filename) {
+        if (image.getSize().x > 0) return texture.loadFromImage(image);
+        const AssetPack& pack = AssetPack::instance();
+        const AssetPack::Entry* entry = pack.find(filename);
+        if (!entry || entry->type != AssetPack::IMAGE) return false;
+        if (!texture.create(entry->width, entry->height)) return false;
+        texture.update(pack.data(*entry)); // width * height * 4 bytes, checked by open()
+        return true;
     }
 
-    void inquisition(Enemy** enemies, int size) {
-        for (int i = 0; i < size; i++) {
-            if (enemies[i]->isAlive()) enemies[i]->takeDMG(INattack);
+    // Fonts from the pack read straight out of the mapping, which stays open for the whole run.
+    static bool tryLoadFont(Font& font, const string& filename) {
+        const AssetPack& pack = AssetPack::instance();
+        const AssetPack::Entry* entry = pack.find(filename);
+        if (entry && entry->type == AssetPack::FONT) {
+            return font.loadFromMemory(pack.data(*entry), (size_t)entry->size);
         }
+        return font.loadFromFile(filename);
     }
 };
-int Inquisition::INattack = 2;
 
-class MagickaCard : public Card {
+// Persistent threads for short data-parallel jobs such as decoding a batch of
+// images. forEach() hands indices to the workers and to the calling thread and
+// returns once all of them are done. Called from the game thread only.
+class WorkerPool {
 private:
-    static int magickaDamage;
-    static bool used;
-public:
-    MagickaCard() {
-        setID(5);
-        setAOE(true);
-        if (TextureLoader::load(texture, "MAGICKA.png")) {
-            sprite.setTexture(texture);
+    vector<thread> threads;
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    const function<void(int)>* job;
+    int jobSize;
+    atomic<int> nextIndex;
+    int busy; // Workers inside the current job
+    unsigned long long generation;
+    bool stopping;
+
+    WorkerPool() : job(nullptr), jobSize(0), nextIndex(0), busy(0), generation(0), stopping(false) {
+        int count = max(0, (int)thread::hardware_concurrency() - 1); // The caller works too
+        for (int i = 0; i < count; i++) {
+            threads.push_back(thread(&WorkerPool::workerLoop, this));
         }
     }
 
-    static void reset() { used = false; }
+    static void work(const function<void(int)>& body, int size, atomic<int>& next) {
+        int index;
+        while ((index = next.fetch_add(1, memory_order_relaxed)) < size) {
+            body(index);
+        }
+    }
 
-    void play(Player* player, Enemy** enemies, int enemyCount) override {
-        if (used) {
-            cout << "Magicka already used this battle!\n";
-            return;
+    // A worker joins a job under the lock, so forEach can't return while it is still in it.
+    void workerLoop() {
+        unsigned long long seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (!job) continue; // Woke after the job had already been finished by the others
+            const function<void(int)>& body = *job;
+            int size = jobSize;
+            busy++;
+            guard.unlock();
+            work(body, size, nextIndex);
+            guard.lock();
+            if (--busy == 0) finished.notify_all();
         }
+    }
 
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i]->isAlive()) {
-                enemies[i]->takeDMG(magickaDamage);
-            }
+public:
+    static WorkerPool& instance() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : threads) {
+            worker.join();
         }
-        used = true;
-        cout << "UNLIMITED POWERRRR! All enemies take " << magickaDamage << " damage!\n";
     }
-};
-int MagickaCard::magickaDamage = 20;
-bool MagickaCard::used = false;
 
-class Deck {
-private:
-    static const int MAX_CARDS = 25;
-    vector<Card*> cards;  // Changed from array to vector for easier management
-    bool hasMagickaCard;
+    int size() const { return (int)threads.size() + 1; }
+
+    void forEach(int count, const function<void(int)>& body) {
+        if (count <= 0) return;
+        {
+            lock_guard<mutex> guard(lock);
+            job = &body;
+            jobSize = count;
+            nextIndex.store(0, memory_order_relaxed);
+            generation++;
+        }
+        wake.notify_all();
+        work(body, count, nextIndex);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&]() { return busy == 0; });
+        job = nullptr;
+    }
+};
 
+// Owns every game texture under one memory budget. A texture is loaded on
+// first request and keeps its address for the whole run, so sprites can hold
+// on to it. When resident textures go over budget, the least recently drawn
+// ones are released (the Texture is emptied, not destroyed) and reloaded by
+// the next frame that draws them. Only textures the render thread has already
+// finished presenting are released. Game thread only, apart from presented().
+class TextureCache {
 public:
-    Deck() : hasMagickaCard(false) {
-        // Initialize with basic cards
-        for (int i = 0; i < 4; i++) {
-            addCard(new SlashCard());
+    enum Category { CARDS, CHARACTERS, MAP, UI, CATEGORY_COUNT };
+
+    // How one kind of texture is made; variant is loader-specific. decode runs
+    // on any thread, upload does the GL part on the game thread.
+    struct Loader {
+        bool (*decode)(Image& image, const string& filename, int variant);
+        bool (*upload)(Texture& texture, const Image& image, const string& filename, int variant);
+    };
+
+    // Textures to load together, see load().
+    class Batch {
+    private:
+        friend class TextureCache;
+
+        struct Request {
+            string filename;
+            Category category;
+            const Loader* loader;
+            int variant;
+        };
+        vector<Request> requests;
+
+    public:
+        Batch& add(const string& filename, Category category, const Loader& loader = fileLoader(), int variant = 0) {
+            Request request = { filename, category, &loader, variant };
+            requests.push_back(request);
+            return *this;
         }
-        for (int i = 0; i < 2; i++) {
-            addCard(new HealCard());
+    };
+
+private:
+    struct Entry {
+        Texture texture;
+        string filename;
+        Category category;
+        const Loader* loader;
+        int variant;
+        size_t bytes;
+        unsigned long long lastDrawn; // Frame sequence that last used it
+        bool resident;
+    };
+
+    vector<Entry*> entries;
+    unordered_map<const Texture*, Entry*> byTexture; // For touch(); an entry's texture never moves
+    size_t budget;
+    size_t residentBytes[CATEGORY_COUNT];
+    size_t residentTotal;
+    unsigned long long building; // Sequence of the frame being built
+    atomic<unsigned long long> presentedFrame;
+    int evictions;
+    int reloads;
+
+    TextureCache() : budget(256u << 20), residentTotal(0), building(1), presentedFrame(0), evictions(0), reloads(0) {
+        for (int i = 0; i < CATEGORY_COUNT; i++) residentBytes[i] = 0;
+    }
+
+    static bool decodeFile(Image& image, const string& filename, int variant) {
+        return TextureLoader::decode(image, filename);
+    }
+
+    static bool uploadFile(Texture& texture, const Image& image, const string& filename, int variant) {
+        return TextureLoader::upload(texture, image, filename);
+    }
+
+    static const char* categoryName(int category) {
+        static const char* names[CATEGORY_COUNT] = { "cards", "characters", "map", "ui" };
+        return names[category];
+    }
+
+    Entry* lookup(const string& filename, const Loader* loader, int variant) {
+        for (Entry* entry : entries) {
+            if (entry->loader == loader && entry->variant == variant && entry->filename == filename) return entry;
         }
-        shuffle();
+        return nullptr;
+    }
+
+    Entry* add(const string& filename, Category category, const Loader* loader, int variant) {
+        Entry* entry = new Entry();
+        entry->filename = filename;
+        entry->category = category;
+        entry->loader = loader;
+        entry->variant = variant;
+        entry->bytes = 0;
+        entry->resident = false;
+        entries.push_back(entry);
+        byTexture[&entry->texture] = entry;
+        return entry;
     }
 
-    ~Deck() {
-        for (Card* card : cards) {
-            delete card;
+    // Decodes here when the image wasn't decoded ahead by load().
+    void makeResident(Entry& entry, const Image* decoded = nullptr) {
+        Image image;
+        bool ok = decoded ? true : entry.loader->decode(image, entry.filename, entry.variant);
+        if (!ok || !entry.loader->upload(entry.texture, decoded ? *decoded : image, entry.filename, entry.variant)) {
+            LOG_ERROR(Log::Assets, "Failed to load texture: %s", entry.filename.c_str());
         }
+        Vector2u size = entry.texture.getSize();
+        entry.bytes = (size_t)size.x * size.y * 4;
+        entry.resident = true;
+        entry.lastDrawn = building;
+        residentBytes[entry.category] += entry.bytes;
+        residentTotal += entry.bytes;
+        trim();
     }
 
-    bool addCard(Card* newCard) {
-        if (cards.size() >= MAX_CARDS) return false;
+    void evict(Entry& entry) {
+        entry.texture = Texture();
+        entry.resident = false;
+        residentBytes[entry.category] -= entry.bytes;
+        residentTotal -= entry.bytes;
+        evictions++;
+        LOG_DEBUG(Log::Assets, "Evicted %s (%u KB)", entry.filename.c_str(), (unsigned)(entry.bytes / 1024));
+    }
 
-        if (newCard->getID() == 5) { // Magicka card
-            if (hasMagickaCard) {
-                delete newCard;
-                return false;
+    // Least recently drawn first, skipping anything a snapshot in flight may use.
+    void trim() {
+        unsigned long long safe = presentedFrame.load(memory_order_acquire);
+        while (residentTotal > budget) {
+            Entry* oldest = nullptr;
+            for (Entry* entry : entries) {
+                if (!entry->resident || entry->lastDrawn > safe) continue;
+                if (!oldest || entry->lastDrawn < oldest->lastDrawn) oldest = entry;
             }
-            hasMagickaCard = true;
+            if (!oldest) return; // Everything resident is in use; over budget until it isn't
+            evict(*oldest);
         }
+    }
 
-        cards.push_back(newCard);
-        return true;
+public:
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
     }
 
-    void shuffle() {
-        random_shuffle(cards.begin(), cards.end());
+    void setBudget(size_t bytes) {
+        budget = bytes;
+        trim();
     }
 
-    Card* draw() {
-        if (cards.empty()) return nullptr;
+    // Plain image files, from the pack or from disk
+    static const Loader& fileLoader() {
+        static const Loader loader = { &TextureCache::decodeFile, &TextureCache::uploadFile };
+        return loader;
+    }
 
-        Card* card = cards.back();
-        cards.pop_back();
-        return card;
+    const Texture& get(const string& filename, Category category, const Loader& loader = fileLoader(), int variant = 0) {
+        Entry* entry = lookup(filename, &loader, variant);
+        if (!entry) {
+            entry = add(filename, category, &loader, variant);
+            makeResident(*entry);
+        }
+        else if (!entry->resident) {
+            makeResident(*entry);
+            reloads++;
+        }
+        entry->lastDrawn = building;
+        return entry->texture;
     }
 
-    void discard(Card* card) {
-        if (cards.size() < MAX_CARDS) {
-            cards.insert(cards.begin(), card); // Add to bottom of deck
+    // Brings a batch in at once: the images decode in parallel on the
+    // WorkerPool and only the uploads run on this thread. Textures already
+    // resident are skipped; later get() calls find the rest ready.
+    void load(const Batch& batch) {
+        vector<Entry*> pending;
+        for (const Batch::Request& request : batch.requests) {
+            Entry* entry = lookup(request.filename, request.loader, request.variant);
+            if (!entry) {
+                entry = add(request.filename, request.category, request.loader, request.variant);
+            }
+            else {
+                if (entry->resident || find(pending.begin(), pending.end(), entry) != pending.end()) continue;
+                reloads++;
+            }
+            pending.push_back(entry);
+        }
+        if (pending.empty()) return;
+
+        // A failed decode leaves its image empty, and the upload reports it.
+        vector<Image> images(pending.size());
+        WorkerPool::instance().forEach((int)pending.size(), [&](int i) {
+            pending[i]->loader->decode(images[i], pending[i]->filename, pending[i]->variant);
+        });
+
+        for (size_t i = 0; i < pending.size(); i++) {
+            makeResident(*pending[i], &images[i]);
+            images[i] = Image(); // Decoded pixels go as soon as they are on the GPU
         }
+        LOG_DEBUG(Log::Assets, "Loaded a batch of %u textures on %d threads", (unsigned)pending.size(), WorkerPool::instance().size());
     }
 
-    void returnToDeck(Card* card) {
-        if (cards.size() < MAX_CARDS) {
-            cards.push_back(card); // Add to top of deck
+    // A texture is going into the frame being built; brings it back if it was
+    // released. Textures the cache doesn't own are ignored.
+    void touch(const Texture* texture) {
+        unordered_map<const Texture*, Entry*>::iterator found = byTexture.find(texture);
+        if (found == byTexture.end()) return;
+        Entry* entry = found->second;
+        entry->lastDrawn = building;
+        if (!entry->resident) {
+            makeResident(*entry);
+            reloads++;
         }
     }
 
-    int getCardCount() const { return cards.size(); }
-    int getMaxCards() const { return MAX_CARDS; }
+    // Renderer: a frame was published, later touches belong to the next one.
+    void published(unsigned long long sequence) { building = sequence + 1; }
+
+    // Render thread: everything up to this frame has been presented.
+    void presented(unsigned long long sequence) { presentedFrame.store(sequence, memory_order_release); }
+
+    // For textures kept outside the cache that follow the same reuse rule.
+    unsigned long long buildingFrame() const { return building; }
+    unsigned long long presentedSequence() const { return presentedFrame.load(memory_order_acquire); }
+
+    void report() const {
+        LOG_INFO(Log::Assets, "Textures: %u KB resident of %u KB budget, %d evictions, %d reloads",
+            (unsigned)(residentTotal / 1024), (unsigned)(budget / 1024), evictions, reloads);
+        for (int i = 0; i < CATEGORY_COUNT; i++) {
+            LOG_INFO(Log::Assets, "    %-10s %6u KB", categoryName(i), (unsigned)(residentBytes[i] / 1024));
+        }
+    }
 };
 
+// Card art is authored at 1087x1535 but only ever shown at a tenth of that. Each
+// card face is kept once per display size instead of once per card instance at
+// full resolution; the asset pack stores the variants ready-made.
+class CardArt {
+public:
+    enum Variant { THUMBNAIL, PREVIEW, VARIANT_COUNT };
 
-class Battle {
 private:
-    Player& player;
-    Deck& deck;
-    int node;
-    RenderWindow& window;
+    // Area-average downscale with alpha weighting, so transparent borders don't bleed dark fringes.
+    static void downscale(const Image& source, Image& target, unsigned width, unsigned height) {
+        Vector2u size = source.getSize();
+        const Uint8* pixels = source.getPixelsPtr();
+        vector<Uint8> result(width * height * 4);
+
+        for (unsigned y = 0; y < height; y++) {
+            unsigned y0 = y * size.y / height;
+            unsigned y1 = max(y0 + 1, (y + 1) * size.y / height);
+            for (unsigned x = 0; x < width; x++) {
+                unsigned x0 = x * size.x / width;
+                unsigned x1 = max(x0 + 1, (x + 1) * size.x / width);
+
+                unsigned long long r = 0, g = 0, b = 0, a = 0, count = 0;
+                for (unsigned sy = y0; sy < y1; sy++) {
+                    const Uint8* row = pixels + (sy * size.x + x0) * 4;
+                    for (unsigned sx = x0; sx < x1; sx++, row += 4) {
+                        r += row[0] * row[3];
+                        g += row[1] * row[3];
+                        b += row[2] * row[3];
+                        a += row[3];
+                        count++;
+                    }
+                }
 
-    Enemy* enemies[4];
-    int enemyCount;
-    Card* hand[4];
-    int cardsInHand;
-    bool playerTurn;
-    bool battleOver;
-    bool playerWon;
-    int selectedCard;
-    int selectedEnemy;
-    Text actionText;
-    Text turnText;
+                Uint8* out = &result[(y * width + x) * 4];
+                out[0] = a ? (Uint8)(r / a) : 0;
+                out[1] = a ? (Uint8)(g / a) : 0;
+                out[2] = a ? (Uint8)(b / a) : 0;
+                out[3] = (Uint8)(a / count);
+            }
+        }
+        target.create(width, height, &result[0]);
+    }
 
-    Texture bgTexture;
-    Sprite background;
-    Font font;
+public:
+    // Scale of each variant relative to the source art: thumbnails match the 0.1
+    // used by the hand and the shop, previews are for the enlarged selected card.
+    static float scaleOf(Variant variant) {
+        return variant == THUMBNAIL ? 0.1f : 0.3f;
+    }
 
-    RectangleShape hpBox;
-    RectangleShape manaBox;
-    Text hpText;
-    Text manaText;
+    static const char* suffix(Variant variant) {
+        return variant == THUMBNAIL ? "@thumbnail" : "@preview";
+    }
 
-    Clock deltaClock;
+    static bool isCardArt(const string& path) {
+        static const char* files[] = { "Slash.png", "HEAL.png", "Drain.png", "Inquisition.png", "MAGICKA.png", "Exhaust.png", "Power.png" };
+        for (const char* file : files) {
+            if (AssetPack::hashPath(path) == AssetPack::hashPath(file)) return true;
+        }
+        return false;
+    }
 
-    const float PLAYER_SCALE = 2.0f;
-    const float ENEMY_SCALE = 2.0f;
-    const float CARD_SCALE = 0.1f;
+    static void makeVariant(const Image& source, Variant variant, Image& target) {
+        float scale = scaleOf(variant);
+        Vector2u size = source.getSize();
+        downscale(source, target, max(1u, (unsigned)(size.x * scale + 0.5f)), max(1u, (unsigned)(size.y * scale + 0.5f)));
+    }
 
-    enum BattleState {
-        SELECT_CARD,
-        SELECT_ENEMY,
-        PROCESSING
-    };
-    BattleState currentState;
+    // Any thread: scales the source art unless the pack has the variant ready.
+    static bool decode(Image& image, const string& filename, int variant) {
+        const AssetPack::Entry* packed = AssetPack::instance().find(filename + suffix((Variant)variant));
+        if (packed && packed->type == AssetPack::IMAGE) return true;
+        Image source;
+        if (!source.loadFromFile(filename)) return false;
+        makeVariant(source, (Variant)variant, image);
+        return true;
+    }
 
-    // Card display members
-    const Vector2f CARD_POSITIONS[4] = {
-        Vector2f(250, 575),
-        Vector2f(400, 575),
-        Vector2f(550, 575),
-        Vector2f(700, 575)
+    // Fills a texture with one card face at one display size. Previews get
+    // mipmaps so they stay clean when drawn smaller than their native size.
+    static bool upload(Texture& texture, const Image& image, const string& filename, int variant) {
+        if (!TextureLoader::upload(texture, image, filename + suffix((Variant)variant))) return false;
+
+        texture.setSmooth(true);
+        if (variant == PREVIEW) texture.generateMipmap();
+        LOG_DEBUG(Log::Assets, "Card art %s%s: %ux%u (%u KB)", filename.c_str(), suffix((Variant)variant),
+            texture.getSize().x, texture.getSize().y, texture.getSize().x * texture.getSize().y * 4 / 1024);
+        return true;
+    }
+
+    static const TextureCache::Loader& loader() {
+        static const TextureCache::Loader cardLoader = { &CardArt::decode, &CardArt::upload };
+        return cardLoader;
+    }
+
+    // Shared texture for one card face at one display size
+    static const Texture& get(const string& filename, Variant variant) {
+        return TextureCache::instance().get(filename, TextureCache::CARDS, loader(), variant);
+    }
+
+    static void request(TextureCache::Batch& batch, const string& filename, Variant variant) {
+        batch.add(filename, TextureCache::CARDS, loader(), variant);
+    }
+};
+
+// Backgrounds are kept as TILE_SIZE tiles so they can grow past the largest
+// texture the GPU takes and be streamed in around the view. The pack stores
+// them already cut, one entry per tile.
+class BackgroundTiles {
+public:
+    static const int TILE_SIZE = 256;
+
+    static bool isTiled(const string& path) {
+        static const char* files[] = { "Images/Map/map_bg.png" };
+        for (const char* file : files) {
+            if (AssetPack::hashPath(path) == AssetPack::hashPath(file)) return true;
+        }
+        return false;
+    }
+
+    static string tileName(const string& path, int column, int row) {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "@tile%d,%d", column, row);
+        return path + suffix;
+    }
+
+    static int tilesAcross(unsigned length) {
+        return (int)((length + TILE_SIZE - 1) / TILE_SIZE);
+    }
+
+    // Copies one tile out of a whole RGBA image into tightly packed rows; edge tiles are smaller.
+    static void copyTile(const Uint8* pixels, unsigned width, unsigned height, int column, int row,
+        Uint8* tile, unsigned& tileWidth, unsigned& tileHeight) {
+        unsigned left = column * TILE_SIZE;
+        unsigned top = row * TILE_SIZE;
+        tileWidth = min((unsigned)TILE_SIZE, width - left);
+        tileHeight = min((unsigned)TILE_SIZE, height - top);
+        for (unsigned y = 0; y < tileHeight; y++) {
+            memcpy(tile + y * tileWidth * 4, pixels + ((top + y) * width + left) * 4, tileWidth * 4);
+        }
+    }
+};
+
+// Offline step (--pack): decodes everything under the asset directory into assets.pak.
+class AssetPacker {
+private:
+    struct Item {
+        string path;
+        AssetPack::Entry entry;
+        vector<unsigned char> bytes;
     };
 
-    void setupEnemies() {
-        if (node < 3) {
-            enemyCount = 3;
-            for (int i = 0; i < enemyCount; i++) {
-                enemies[i] = new Cronie();
-            }
+    static string extension(const string& path) {
+        size_t dot = path.find_last_of('.');
+        if (dot == string::npos) return "";
+        string ext = path.substr(dot + 1);
+        for (char& c : ext) c = (char)tolower((unsigned char)c);
+        return ext;
+    }
+
+    static void listFiles(const string& directory, vector<string>& files) {
+#ifdef _WIN32
+        WIN32_FIND_DATAA found;
+        HANDLE search = FindFirstFileA((directory + "/*").c_str(), &found);
+        if (search == INVALID_HANDLE_VALUE) return;
+        do {
+            string name = found.cFileName;
+            if (name == "." || name == "..") continue;
+            string path = directory == "." ? name : directory + "/" + name;
+            if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) listFiles(path, files);
+            else files.push_back(path);
+        } while (FindNextFileA(search, &found));
+        FindClose(search);
+#else
+        DIR* dir = opendir(directory.c_str());
+        if (!dir) return;
+        while (dirent* found = readdir(dir)) {
+            string name = found->d_name;
+            if (name == "." || name == "..") continue;
+            string path = directory == "." ? name : directory + "/" + name;
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) continue;
+            if (S_ISDIR(info.st_mode)) listFiles(path, files);
+            else files.push_back(path);
         }
-        else if (node >= 3 && node < 7) {
-            enemyCount = 4;
-            for (int i = 0; i < enemyCount; i++) {
-                enemies[i] = (rand() % 100 < 75) ? (Enemy*)(new Cronie()) : (Enemy*)(new Captain());
+        closedir(dir);
+#endif
+    }
+
+    static bool readFile(const string& path, vector<unsigned char>& bytes) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        bytes.resize(size > 0 ? (size_t)size : 0);
+        bool ok = bytes.empty() || fread(&bytes[0], 1, bytes.size(), file) == bytes.size();
+        fclose(file);
+        return ok;
+    }
+
+public:
+    static bool build(const string& directory, const string& output) {
+        vector<string> files;
+        listFiles(directory, files);
+
+        vector<Item> items;
+        for (const string& path : files) {
+            string ext = extension(path);
+            Item item;
+            item.path = path;
+            item.entry = AssetPack::Entry();
+            item.entry.pathHash = AssetPack::hashPath(path);
+
+            if (ext == "png" || ext == "jpg" || ext == "jpeg" || ext == "bmp" || ext == "tga") {
+                Image image;
+                if (!image.loadFromFile(path)) {
+                    LOG_ERROR(Log::Assets, "Pack: cannot decode %s", path.c_str());
+                    continue;
+                }
+                item.entry.type = AssetPack::IMAGE;
+                item.entry.width = image.getSize().x;
+                item.entry.height = image.getSize().y;
+                const Uint8* pixels = image.getPixelsPtr();
+
+                if (BackgroundTiles::isTiled(path)) {
+                    item.entry.type = AssetPack::TILES;
+                    int columns = BackgroundTiles::tilesAcross(item.entry.width);
+                    int rows = BackgroundTiles::tilesAcross(item.entry.height);
+                    for (int row = 0; row < rows; row++) {
+                        for (int column = 0; column < columns; column++) {
+                            Item tile;
+                            tile.path = BackgroundTiles::tileName(path, column, row);
+                            tile.entry = AssetPack::Entry();
+                            tile.entry.pathHash = AssetPack::hashPath(tile.path);
+                            tile.entry.type = AssetPack::IMAGE;
+                            tile.bytes.resize(BackgroundTiles::TILE_SIZE * BackgroundTiles::TILE_SIZE * 4);
+                            BackgroundTiles::copyTile(pixels, item.entry.width, item.entry.height, column, row,
+                                &tile.bytes[0], tile.entry.width, tile.entry.height);
+                            tile.bytes.resize(tile.entry.width * tile.entry.height * 4);
+                            tile.entry.size = tile.bytes.size();
+                            items.push_back(tile);
+                        }
+                    }
+                }
+                else {
+                    item.bytes.assign(pixels, pixels + item.entry.width * item.entry.height * 4);
+                }
+
+                // Card faces also get their display-size variants.
+                if (CardArt::isCardArt(path)) {
+                    for (int v = 0; v < CardArt::VARIANT_COUNT; v++) {
+                        Image scaled;
+                        CardArt::makeVariant(image, (CardArt::Variant)v, scaled);
+                        Item variant;
+                        variant.path = path + CardArt::suffix((CardArt::Variant)v);
+                        variant.entry = item.entry;
+                        variant.entry.pathHash = AssetPack::hashPath(variant.path);
+                        variant.entry.width = scaled.getSize().x;
+                        variant.entry.height = scaled.getSize().y;
+                        variant.bytes.assign(scaled.getPixelsPtr(), scaled.getPixelsPtr() + variant.entry.width * variant.entry.height * 4);
+                        variant.entry.size = variant.bytes.size();
+                        items.push_back(variant);
+                    }
+                }
+            }
+            else if (ext == "ttf" || ext == "otf") {
+                if (!readFile(path, item.bytes)) continue;
+                item.entry.type = AssetPack::FONT;
             }
+            else {
+                continue;
+            }
+            item.entry.size = item.bytes.size();
+            items.push_back(item);
         }
-        else {
-            enemyCount = 4;
-            enemies[0] = new Boss();
-            for (int i = 1; i < enemyCount; i++) {
-                enemies[i] = (rand() % 100 < 75) ? (Enemy*)(new Cronie()) : (Enemy*)(new Captain());
+
+        sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+            return a.entry.pathHash < b.entry.pathHash;
+        });
+        for (size_t i = 1; i < items.size(); i++) {
+            if (items[i].entry.pathHash == items[i - 1].entry.pathHash) {
+                LOG_ERROR(Log::Assets, "Pack: %s and %s collide (paths differ only in case?)",
+                    items[i - 1].path.c_str(), items[i].path.c_str());
+                return false;
             }
         }
 
-        float startY = 150;
-        float spacing = (600 - startY) / (enemyCount + 1);
-        for (int i = 0; i < enemyCount; i++) {
-            float x = 800;
-            float y = startY + spacing * (i + 1);
-            enemies[i]->getSprite().setPosition(x, y);
-            enemies[i]->getSprite().setScale(-ENEMY_SCALE, ENEMY_SCALE);
-            enemies[i]->getSprite().setOrigin(
-                enemies[i]->getSprite().getLocalBounds().width / 2,
-                enemies[i]->getSprite().getLocalBounds().height / 2
-            );
+        // Data blobs follow the index, 16-byte aligned.
+        AssetPack::Header header = AssetPack::Header();
+        memcpy(header.magic, "MAGPACK", 8);
+        header.version = AssetPack::VERSION;
+        header.entryCount = (Uint32)items.size();
+        Uint64 offset = sizeof(AssetPack::Header) + items.size() * sizeof(AssetPack::Entry);
+        for (Item& item : items) {
+            offset = (offset + 15) & ~(Uint64)15;
+            item.entry.offset = offset;
+            offset += item.entry.size;
         }
-    }
 
-    void setupUI() {
-        player.getSprite().setPosition(200, 360);
-        player.getSprite().setScale(PLAYER_SCALE, PLAYER_SCALE);
-        player.getSprite().setOrigin(
-            player.getSprite().getLocalBounds().width / 2,
-            player.getSprite().getLocalBounds().height / 2
-        );
+        FILE* file = fopen(output.c_str(), "wb");
+        if (!file) {
+            LOG_ERROR(Log::Assets, "Pack: cannot write %s", output.c_str());
+            return false;
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        for (const Item& item : items) {
+            fwrite(&item.entry, sizeof(item.entry), 1, file);
+        }
+        static const unsigned char padding[16] = {};
+        for (const Item& item : items) {
+            long position = ftell(file);
+            fwrite(padding, 1, (size_t)(item.entry.offset - position), file);
+            if (!item.bytes.empty()) fwrite(&item.bytes[0], 1, item.bytes.size(), file);
+            LOG_INFO(Log::Assets, "Packed %s (%u bytes)", item.path.c_str(), (unsigned)item.entry.size);
+        }
+        fclose(file);
 
-        hpBox.setSize(Vector2f(200, 30));
-        hpBox.setPosition(900, 650);
-        hpBox.setFillColor(Color(200, 50, 50, 200));
+        LOG_INFO(Log::Assets, "Wrote %s: %u assets, %.1f MB", output.c_str(), header.entryCount, offset / 1048576.0);
+        return true;
+    }
+};
 
-        hpText.setFont(font);
-        hpText.setCharacterSize(24);
-        hpText.setPosition(910, 650);
+class Animation {
+public:
+    enum ClipType { IDLE, ATTACK, DYING, HEAL, CLIP_TYPES };
 
-        manaBox.setSize(Vector2f(200, 30));
-        manaBox.setPosition(1150, 650);
-        manaBox.setFillColor(Color(50, 50, 200, 200));
+    struct ClipSet {
+        int clips[CLIP_TYPES];
+    };
 
-        manaText.setFont(font);
-        manaText.setCharacterSize(24);
-        manaText.setPosition(1160, 650);
+private:
+    // Frame rects for every clip live in one table; a clip is a slice of it.
+    struct Clip {
+        const Texture* texture;
+        int firstFrame;
+        int frameCount;
+        float frameDuration;
+        bool loop;
+        Vector2f origin;
+        Color tint;
+    };
 
-        actionText.setFont(font);
-        actionText.setCharacterSize(24);
-        actionText.setPosition(50, 600);
-        actionText.setFillColor(Color::White);
+    struct Animator {
+        Sprite* sprite;
+        ClipSet clips;
+        int clip;
+        int frame;
+        float time;
+        bool active;
+    };
 
-        turnText.setFont(font);
-        turnText.setCharacterSize(36);
-        turnText.setFillColor(Color::White);
-        updateTurnText();
+    static vector<IntRect>& frameTable() { static vector<IntRect> frames; return frames; }
+    static vector<Clip>& clipTable() { static vector<Clip> clips; return clips; }
+    static vector<Animator>& animators() { static vector<Animator> pool; return pool; }
+    static vector<int>& freeSlots() { static vector<int> slots; return slots; }
+    static const Texture* sheet(const string& filename) {
+        return &TextureCache::instance().get(filename, TextureCache::CHARACTERS);
     }
 
-    void fillHand() {
-        // Clear current hand first
-        for (int i = 0; i < 4; i++) {
-            if (hand[i]) {
-                deck.discard(hand[i]);
-                hand[i] = nullptr;
-            }
+    // Frames are split evenly along the sheet; the origin keeps the feet of shorter
+    // frames (e.g. the 20px cronie death) on the same baseline as the 32px ones.
+    static int createClip(const Texture* texture, int frameCount, float frameDuration, bool loop, Color tint) {
+        Vector2u size = texture->getSize();
+        int frameWidth = size.x > 0 ? (int)size.x / frameCount : 32;
+        int frameHeight = size.y > 0 ? (int)size.y : 32;
+
+        Clip clip;
+        clip.texture = texture;
+        clip.firstFrame = (int)frameTable().size();
+        clip.frameCount = frameCount;
+        clip.frameDuration = frameDuration;
+        clip.loop = loop;
+        clip.origin = Vector2f(frameWidth / 2.f, frameHeight - 16.f);
+        clip.tint = tint;
+        for (int i = 0; i < frameCount; i++) {
+            frameTable().push_back(IntRect(i * frameWidth, 0, frameWidth, frameHeight));
         }
+        clipTable().push_back(clip);
+        return (int)clipTable().size() - 1;
+    }
 
-        // Draw new cards
-        cardsInHand = 0;
-        for (int i = 0; i < 4; i++) {
-            hand[i] = deck.draw();
-            if (hand[i]) {
-                cardsInHand++;
-                hand[i]->getSprite().setScale(CARD_SCALE, CARD_SCALE);
-            }
+    static void applyFrame(Animator& animator) {
+        const Clip& clip = clipTable()[animator.clip];
+        animator.sprite->setTextureRect(frameTable()[clip.firstFrame + animator.frame]);
+    }
+
+    static void applyClip(Animator& animator) {
+        const Clip& clip = clipTable()[animator.clip];
+        animator.sprite->setTexture(*clip.texture);
+        animator.sprite->setOrigin(clip.origin);
+        animator.sprite->setColor(clip.tint);
+        applyFrame(animator);
+    }
+
+public:
+    // Builds (once per sheet pair) the idle/attack/dying/heal clips of a character.
+    // There is no dedicated attack or heal art, so those replay the standing sheet
+    // quickly with a tint.
+    static ClipSet characterClips(const string& standingFile, const string& dyingFile) {
+        static vector<pair<string, ClipSet>> cache;
+        string key = standingFile + "|" + dyingFile;
+        for (auto& entry : cache) {
+            if (entry.first == key) return entry.second;
         }
-        updateActionText();
+
+        const Texture* standing = sheet(standingFile);
+        const Texture* dying = sheet(dyingFile);
+        ClipSet set;
+        set.clips[IDLE] = createClip(standing, TextureLoader::FRAME_COUNT, 0.1f, true, Color::White);
+        set.clips[ATTACK] = createClip(standing, TextureLoader::FRAME_COUNT, 0.04f, false, Color(255, 170, 170));
+        set.clips[DYING] = createClip(dying, TextureLoader::FRAME_COUNT, 0.1f, false, Color::White);
+        set.clips[HEAL] = createClip(standing, TextureLoader::FRAME_COUNT, 0.06f, false, Color(170, 255, 170));
+        cache.push_back(make_pair(key, set));
+        return set;
     }
 
-    void cleanup() {
-        for (int i = 0; i < enemyCount; i++) {
-            delete enemies[i];
-            enemies[i] = nullptr;
+    static int create(Sprite& sprite, const ClipSet& clips) {
+        int slot;
+        if (!freeSlots().empty()) {
+            slot = freeSlots().back();
+            freeSlots().pop_back();
         }
-        for (int i = 0; i < 4; i++) {
-            if (hand[i]) {
-                deck.discard(hand[i]);
-                hand[i] = nullptr;
-            }
+        else {
+            animators().push_back(Animator());
+            slot = (int)animators().size() - 1;
         }
-        cardsInHand = 0;
+
+        Animator& animator = animators()[slot];
+        animator.sprite = &sprite;
+        animator.clips = clips;
+        animator.clip = clips.clips[IDLE];
+        animator.frame = 0;
+        animator.time = 0.f;
+        animator.active = true;
+        applyClip(animator);
+        return slot;
     }
 
-    void awardCoins() {
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i]) {
-                switch (enemies[i]->getEnemyType()) {
-                case 0: player.increaseCoins(15); break;
-                case 1: player.increaseCoins(25); break;
-                case 2: player.increaseCoins(50); break;
-                }
-            }
-        }
-        player.increaseCoins(50);
+    static void destroy(int slot) {
+        if (slot < 0) return;
+        animators()[slot].active = false;
+        animators()[slot].sprite = nullptr;
+        freeSlots().push_back(slot);
     }
 
-    void updateActionText() {
-        string text;
-        if (currentState == SELECT_CARD) {
-            text = "Select a card:\n";
-            for (int i = 0; i < 4; i++) {
-                if (hand[i]) {
-                    text += to_string(i + 1) + ") ";
-                    switch (hand[i]->getID()) {
-                    case 0: text += "Slash"; break;
-                    case 1: text += "Heal"; break;
-                    case 2: text += "Drain"; break;
-                    case 3: text += "Inquisition"; break;
-                    case 5: text += "Magicka"; break;
-                    }
-                    text += " (Cost: 1)\n";
+    // Combat events switch clips; a dying character ignores everything else.
+    static void play(int slot, ClipType type) {
+        if (slot < 0) return;
+        Animator& animator = animators()[slot];
+        if (animator.clip == animator.clips.clips[DYING]) return;
+
+        animator.clip = animator.clips.clips[type];
+        animator.frame = 0;
+        animator.time = 0.f;
+        applyClip(animator);
+    }
+
+    // Back to idle even from a death clip (an undone kill).
+    static void revive(int slot) {
+        if (slot < 0) return;
+        Animator& animator = animators()[slot];
+        animator.clip = animator.clips.clips[IDLE];
+        animator.frame = 0;
+        animator.time = 0.f;
+        applyClip(animator);
+    }
+
+    // Advances every live animator by the frame delta in one pass over the pool.
+    static void tick(float deltaTime) {
+        vector<Animator>& pool = animators();
+        for (size_t i = 0; i < pool.size(); i++) {
+            Animator& animator = pool[i];
+            if (!animator.active) continue;
+
+            const Clip& clip = clipTable()[animator.clip];
+            animator.time += deltaTime;
+            if (animator.time < clip.frameDuration) continue;
+
+            int steps = (int)(animator.time / clip.frameDuration);
+            animator.time -= steps * clip.frameDuration;
+            int frame = animator.frame + steps;
+
+            if (frame >= clip.frameCount) {
+                if (clip.loop) {
+                    frame %= clip.frameCount;
                 }
-            }
-            text += "Press ENTER to end turn";
-        }
-        else if (currentState == SELECT_ENEMY) {
-            text = "Select target:\n";
-            int aliveCount = 0;
-            for (int i = 0; i < enemyCount; i++) {
-                if (enemies[i] && enemies[i]->isAlive()) {
-                    aliveCount++;
-                    text += to_string(aliveCount) + ") ";
-                    switch (enemies[i]->getEnemyType()) {
-                    case 0: text += "Cronie"; break;
-                    case 1: text += "Captain"; break;
-                    case 2: text += "Boss"; break;
-                    }
-                    text += "\n";
+                else if (animator.clip == animator.clips.clips[DYING]) {
+                    frame = clip.frameCount - 1; // Hold the last death frame
+                }
+                else {
+                    animator.clip = animator.clips.clips[IDLE]; // Attack/heal fall back to idle
+                    animator.frame = 0;
+                    applyClip(animator);
+                    continue;
                 }
             }
-            text += "Press ESC to cancel";
+
+            if (frame != animator.frame) {
+                animator.frame = frame;
+                applyFrame(animator);
+            }
+        }
+    }
+};
+
+class FixedTimestep {
+private:
+    float step;
+    int maxSteps;
+    float accumulator;
+    bool unthrottled;
+    Clock clock;
+
+public:
+    // Unthrottled timesteps ignore wall time and hand out one tick per call (headless runs).
+    explicit FixedTimestep(float tickRate = 60.f, int maxCatchUpSteps = 5, bool runUnthrottled = false) :
+        step(1.f / tickRate), maxSteps(maxCatchUpSteps), accumulator(0.f), unthrottled(runUnthrottled) {
+    }
+
+    // Number of logic ticks owed since the last call. A long stall (a nested loop, a
+    // blocking load) only pays back maxSteps ticks; the rest of the backlog is dropped.
+    int advance() {
+        if (unthrottled) return 1;
+
+        accumulator += clock.restart().asSeconds();
+        int steps = (int)(accumulator / step);
+        if (steps > maxSteps) {
+            steps = maxSteps;
+            accumulator = fmod(accumulator, step);
         }
         else {
-            text = "Processing...";
+            accumulator -= steps * step;
         }
-        actionText.setString(text);
+        return steps;
     }
 
-    void updateTurnText() {
-        turnText.setString(playerTurn ? "Player Turn" : "Enemy Turn");
-        turnText.setPosition(640 - turnText.getLocalBounds().width / 2, 20);
+    float getStep() const { return step; }
+    bool isUnthrottled() const { return unthrottled; }
+
+    void reset() {
+        accumulator = 0.f;
+        clock.restart();
     }
+};
 
-    void handleCardSelection(int cardNum) {
-        if (cardNum < 1 || cardNum > 4 || !hand[cardNum - 1] || player.getCurrentMana() < 1) {
-            return;
-        }
+// Log-linear histogram over non-negative integers: exact below 32, then 16
+// buckets per power of two (within about 3%). Fixed size; merging adds counts.
+class HdrHistogram {
+private:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int HALF_COUNT = SUB_COUNT / 2;
+    static const int BUCKETS = SUB_COUNT + (64 - SUB_BITS) * HALF_COUNT;
+
+    Uint64 counts[BUCKETS];
+    Uint64 total;
+    Uint64 lowest;
+    Uint64 highest;
+    double sum;
+
+    static int highestBit(Uint64 value) {
+        int bit = 0;
+        while (value >>= 1) bit++;
+        return bit;
+    }
 
-        selectedCard = cardNum - 1;
-        if (hand[selectedCard]->getID() == 1) { // Heal card
-            playSelectedCard(-1); // -1 means target player
+    static int indexOf(Uint64 value) {
+        if (value < SUB_COUNT) return (int)value;
+        int shift = highestBit(value) - SUB_BITS + 1;
+        return SUB_COUNT + (shift - 1) * HALF_COUNT + (int)(value >> shift) - HALF_COUNT;
+    }
+
+    // Midpoint of the values that land in a bucket
+    static Uint64 valueOf(int index) {
+        if (index < SUB_COUNT) return index;
+        int shift = (index - SUB_COUNT) / HALF_COUNT + 1;
+        Uint64 mantissa = (index - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+        return (mantissa << shift) + ((Uint64)1 << (shift - 1));
+    }
+
+public:
+    HdrHistogram() { clear(); }
+
+    void clear() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        lowest = ~(Uint64)0;
+        highest = 0;
+        sum = 0.0;
+    }
+
+    void record(Uint64 value, Uint64 count = 1) {
+        counts[indexOf(value)] += count;
+        total += count;
+        lowest = min(lowest, value);
+        highest = max(highest, value);
+        sum += (double)value * count;
+    }
+
+    void merge(const HdrHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
         }
-        else {
-            currentState = SELECT_ENEMY;
+        total += other.total;
+        lowest = min(lowest, other.lowest);
+        highest = max(highest, other.highest);
+        sum += other.sum;
+    }
+
+    Uint64 count() const { return total; }
+    Uint64 minimum() const { return total ? lowest : 0; }
+    Uint64 maximum() const { return highest; }
+    double mean() const { return total ? sum / total : 0.0; }
+
+    Uint64 quantile(double q) const {
+        if (!total) return 0;
+        Uint64 rank = (Uint64)(q * (total - 1));
+        Uint64 seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen > rank) return min(highest, max(lowest, valueOf(i)));
         }
-        updateActionText();
+        return highest;
     }
+};
 
-    void handleEnemySelection(int enemyNum) {
-        if (enemyNum < 1) return;
+// Single entry point for player input. Window events are stamped when they are
+// pulled from the OS queue and turned into actions, which the active loop then
+// hands to its scene. Frames published after an action is handled carry the
+// newest handled arrival time until the render thread presents one; every
+// action handled up to then is sampled against that present, which gives the
+// input-to-photon latency of each action.
+class InputSystem {
+public:
+    enum Action { CONFIRM, BACK, TOGGLE_HINT, UNDO, REDO, SELECT, QUIT };
 
-        int aliveCount = 0;
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i] && enemies[i]->isAlive()) {
-                aliveCount++;
-                if (aliveCount == enemyNum) {
-                    playSelectedCard(i);
-                    return;
-                }
+    struct Input {
+        Action action;
+        int slot; // SELECT only: 0 for key 1 ... 9 for key 0
+        Uint64 arrival; // Microseconds on the input clock
+    };
+
+    static const int QUEUE_SIZE = 64;
+    static const Uint64 FRAME_BUDGET = 16667; // One frame at 60 Hz, in microseconds
+
+private:
+    Clock clock;
+    Input queue[QUEUE_SIZE];
+    int head;
+    int tail;
+
+    struct Present {
+        Uint64 arrival; // Newest arrival the frame carried
+        Uint64 at;
+    };
+
+    Uint64 unpresented[QUEUE_SIZE]; // Game thread: handled arrivals no frame has shown yet, oldest first
+    int unpresentedCount;
+    HdrHistogram latency; // Game thread
+
+    // Single-producer/single-consumer: the render thread reports presents, the game thread samples them.
+    Present presents[QUEUE_SIZE];
+    atomic<unsigned> presentHead;
+    atomic<unsigned> presentTail;
+    Uint64 lastPresented; // Render thread only
+
+    InputSystem() : head(0), tail(0), unpresentedCount(0), presentHead(0), presentTail(0), lastPresented(0) {}
+
+    // Samples each handled arrival against the first present that showed it.
+    void collectPresented() {
+        unsigned first = presentTail.load(memory_order_relaxed);
+        unsigned last = presentHead.load(memory_order_acquire);
+        for (unsigned i = first; i != last; i++) {
+            const Present& present = presents[i % QUEUE_SIZE];
+            int kept = 0;
+            for (int j = 0; j < unpresentedCount; j++) {
+                if (unpresented[j] <= present.arrival) latency.record(present.at - unpresented[j]);
+                else unpresented[kept++] = unpresented[j];
             }
+            unpresentedCount = kept;
+        }
+        presentTail.store(last, memory_order_release);
+    }
+
+    static bool toAction(const Event& event, Input& input) {
+        if (event.type == Event::Closed) {
+            input.action = QUIT;
+            return true;
+        }
+        if (event.type != Event::KeyPressed) return false;
+
+        Keyboard::Key key = event.key.code;
+        input.slot = 0;
+        if (key >= Keyboard::Num1 && key <= Keyboard::Num9) {
+            input.action = SELECT;
+            input.slot = key - Keyboard::Num1;
+        }
+        else if (key >= Keyboard::Numpad1 && key <= Keyboard::Numpad9) {
+            input.action = SELECT;
+            input.slot = key - Keyboard::Numpad1;
+        }
+        else if (key == Keyboard::Num0 || key == Keyboard::Numpad0) {
+            input.action = SELECT;
+            input.slot = 9;
+        }
+        else if (key == Keyboard::Enter) input.action = CONFIRM;
+        else if (key == Keyboard::Escape) input.action = BACK;
+        else if (key == Keyboard::H) input.action = TOGGLE_HINT;
+        else if (key == Keyboard::Z) input.action = UNDO;
+        else if (key == Keyboard::Y) input.action = REDO;
+        else return false;
+        return true;
+    }
+
+public:
+    static InputSystem& instance() {
+        static InputSystem input;
+        return input;
+    }
+
+    Uint64 now() const { return (Uint64)clock.getElapsedTime().asMicroseconds(); }
+
+    // Drains the window's event queue. Input beyond QUEUE_SIZE is dropped.
+    void poll(RenderWindow& window) {
+        Event event;
+        while (window.pollEvent(event)) {
+            Input input = Input();
+            if (!toAction(event, input)) continue;
+            input.arrival = now();
+            if (tail - head == QUEUE_SIZE) {
+                LOG_WARN(Log::Game, "Input queue full, dropping input");
+                continue;
+            }
+            queue[tail++ % QUEUE_SIZE] = input;
+        }
+    }
+
+    bool next(Input& input) {
+        if (head == tail) return false;
+        input = queue[head++ % QUEUE_SIZE];
+        if (head == tail) head = tail = 0;
+        return true;
+    }
+
+    // Game thread: an input that arrived then has changed what is drawn.
+    void handled(Uint64 arrival) {
+        if (unpresentedCount == QUEUE_SIZE) return; // Frames have stalled; the oldest ones are kept
+        unpresented[unpresentedCount++] = arrival;
+    }
+
+    // Game thread, when publishing: the newest arrival this frame reflects, or 0.
+    Uint64 pendingArrival() {
+        collectPresented();
+        return unpresentedCount ? unpresented[unpresentedCount - 1] : 0;
+    }
+
+    // Render thread, after display(). Only the first present of an arrival counts.
+    void presented(Uint64 arrival) {
+        if (!arrival || arrival <= lastPresented) return;
+        lastPresented = arrival;
+        unsigned slot = presentHead.load(memory_order_relaxed);
+        if (slot - presentTail.load(memory_order_acquire) == QUEUE_SIZE) return; // Game thread stalled; sample lost
+        presents[slot % QUEUE_SIZE].arrival = arrival;
+        presents[slot % QUEUE_SIZE].at = now();
+        presentHead.store(slot + 1, memory_order_release);
+    }
+
+    // Call once the render thread has stopped.
+    void report() {
+        collectPresented();
+        if (!latency.count()) return;
+        Uint64 p50 = latency.quantile(0.5);
+        Uint64 p99 = latency.quantile(0.99);
+        LOG_INFO(Log::Game, "Input latency over %llu inputs: p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+            (unsigned long long)latency.count(), p50 / 1000.0, p99 / 1000.0, latency.maximum() / 1000.0);
+        if (p99 > FRAME_BUDGET) {
+            LOG_WARN(Log::Game, "Input latency p99 is over one 60 Hz frame (%.2f ms)", FRAME_BUDGET / 1000.0);
+        }
+    }
+};
+
+class StaticLayer;
+
+// One frame as the render thread will draw it. Everything is copied out of the
+// scene objects, so the game thread is free to change them once this is published.
+class RenderSnapshot {
+public:
+    enum CommandType { SPRITE, TEXT, RECTANGLE, LAYER, VERTICES };
+
+    struct Command {
+        CommandType type;
+        const Texture* texture;
+        const Font* font;
+        IntRect textureRect;
+        Vector2f position;
+        Vector2f previousPosition; // Position one tick earlier, for interpolation
+        Vector2f scale;
+        Vector2f origin;
+        Vector2f size;
+        float rotation;
+        float anchor; // Text only: 0 = left edge at x, 0.5 = centred on x
+        Color color;
+        unsigned characterSize;
+        unsigned textStart;
+        unsigned textLength;
+        int layerId;
+        unsigned layerVersion;
+        unsigned layerIndex;
+        unsigned vertexStart;
+        unsigned vertexCount;
+    };
+
+private:
+    friend class Renderer;
+    friend class StaticLayer;
+
+    vector<Command> commands;
+    vector<char> text;
+    vector<Vertex> vertices;
+    vector<shared_ptr<const RenderSnapshot>> layers;
+    vector<const Texture*> textures; // Layer content only: each texture it draws, once
+    bool layerContent;
+    Color clearColor;
+    unsigned long long sequence;
+    float tickTime;
+    float tickStep;
+    Uint64 inputArrival; // Oldest input this frame is the first to show, 0 for none
+    bool blank; // Nothing to draw; keep whatever is on screen
+
+    // Recorded once per rebuild, so drawing the layer touches a short list
+    // instead of every command.
+    void addLayerTexture(const Texture* texture) {
+        if (find(textures.begin(), textures.end(), texture) == textures.end()) textures.push_back(texture);
+    }
+
+public:
+    RenderSnapshot() : layerContent(false), sequence(0), tickTime(0.f), tickStep(1.f), inputArrival(0), blank(true) {}
+
+    void reset() {
+        commands.clear();
+        text.clear();
+        vertices.clear();
+        layers.clear();
+        textures.clear();
+        clearColor = Color::Black;
+        blank = false;
+    }
+
+    void clear(Color color = Color::Black) { clearColor = color; }
+
+    void draw(const Sprite& sprite) { draw(sprite, sprite.getPosition()); }
+
+    void draw(const Sprite& sprite, Vector2f previousPosition) {
+        if (!sprite.getTexture()) return;
+        TextureCache::instance().touch(sprite.getTexture());
+        if (layerContent) addLayerTexture(sprite.getTexture());
+        Command command = Command();
+        command.type = SPRITE;
+        command.texture = sprite.getTexture();
+        command.textureRect = sprite.getTextureRect();
+        command.position = sprite.getPosition();
+        command.previousPosition = previousPosition;
+        command.scale = sprite.getScale();
+        command.origin = sprite.getOrigin();
+        command.rotation = sprite.getRotation();
+        command.color = sprite.getColor();
+        commands.push_back(command);
+    }
+
+    void draw(const Text& label, float anchor = 0.f) {
+        if (!label.getFont()) return;
+        Command command = Command();
+        command.type = TEXT;
+        command.font = label.getFont();
+        command.position = label.getPosition();
+        command.previousPosition = command.position;
+        command.anchor = anchor;
+        command.color = label.getFillColor();
+        command.characterSize = label.getCharacterSize();
+        command.textStart = (unsigned)text.size();
+
+        const String& value = label.getString();
+        for (size_t i = 0; i < value.getSize(); i++) {
+            text.push_back(value[i] < 128 ? (char)value[i] : '?');
+        }
+        command.textLength = (unsigned)text.size() - command.textStart;
+        commands.push_back(command);
+    }
+
+    void draw(const RectangleShape& shape) {
+        Command command = Command();
+        command.type = RECTANGLE;
+        command.position = shape.getPosition();
+        command.previousPosition = command.position;
+        command.size = shape.getSize();
+        command.color = shape.getFillColor();
+        commands.push_back(command);
+    }
+
+    void draw(const StaticLayer& layer);
+
+    // Reserves count textured triangle vertices. Consecutive batches that share a
+    // texture are merged into one draw call. The pointer is valid until the next append.
+    Vertex* appendVertices(const Texture* texture, size_t count) {
+        if (commands.empty() || commands.back().type != VERTICES || commands.back().texture != texture) {
+            Command command = Command();
+            command.type = VERTICES;
+            command.texture = texture;
+            command.vertexStart = (unsigned)vertices.size();
+            commands.push_back(command);
+            if (layerContent && texture) addLayerTexture(texture);
+        }
+        size_t start = vertices.size();
+        vertices.resize(start + count);
+        commands.back().vertexCount += (unsigned)count;
+        return &vertices[start];
+    }
+};
+
+// Content that only changes on player actions. The render thread draws it once
+// into an offscreen texture and composites that as one quad until the owner
+// invalidates it (or the window size changes).
+class StaticLayer {
+private:
+    int id;
+    unsigned version;
+    bool dirty;
+    shared_ptr<const RenderSnapshot> content;
+
+    static int nextId() {
+        static atomic<int> counter(0);
+        return ++counter;
+    }
+
+public:
+    StaticLayer() : id(nextId()), version(0), dirty(true) {}
+
+    void invalidate() { dirty = true; }
+    bool isDirty() const { return dirty; }
+
+    // Snapshots already published keep the old content alive; the new one is recorded fresh.
+    RenderSnapshot& rebuild() {
+        shared_ptr<RenderSnapshot> fresh = make_shared<RenderSnapshot>();
+        fresh->reset();
+        fresh->layerContent = true;
+        content = fresh;
+        version++;
+        dirty = false;
+        return *fresh;
+    }
+
+    int getId() const { return id; }
+    unsigned getVersion() const { return version; }
+    const shared_ptr<const RenderSnapshot>& getContent() const { return content; }
+};
+
+inline void RenderSnapshot::draw(const StaticLayer& layer) {
+    if (!layer.getContent()) return;
+    // The render thread may redraw the layer from its content at any time.
+    for (const Texture* texture : layer.getContent()->textures) {
+        TextureCache::instance().touch(texture);
+        if (layerContent) addLayerTexture(texture);
+    }
+    Command command = Command();
+    command.type = LAYER;
+    command.layerId = layer.getId();
+    command.layerVersion = layer.getVersion();
+    command.layerIndex = (unsigned)layers.size();
+    command.color = Color::White;
+    layers.push_back(layer.getContent());
+    commands.push_back(command);
+}
+
+// Digits and the fixed HUD vocabulary, rasterised once at startup into a single
+// atlas for every HUD size. Counters are emitted straight into the snapshot as
+// quads from precomputed tables, so a changing number never triggers a text layout.
+class HudFont {
+public:
+    enum Word { HP, MANA, COINS, COINS_SUFFIX, UPGRADE, UNLOCK, WORD_COUNT };
+
+    class Line;
+
+private:
+    static const int SIZE_COUNT = 4;
+    static const int ATLAS_WIDTH = 512;
+
+    struct GlyphQuad {
+        FloatRect bounds;
+        FloatRect uv;
+        float advance;
+        bool present;
+    };
+
+    struct WordRun {
+        vector<Vertex> vertices; // Laid out from a pen position of (0, 0)
+        float width;
+    };
+
+    struct SizeTable {
+        unsigned size;
+        GlyphQuad glyphs[128];
+        WordRun words[WORD_COUNT];
+    };
+
+    Font font;
+    Texture atlas;
+    SizeTable tables[SIZE_COUNT];
+    bool ready;
+
+    static const char* wordText(int word) {
+        static const char* words[WORD_COUNT] = {
+            "HP: ", "Mana: ", "Coins: ", " coins", "Upgrade: ", "Unlock: "
+        };
+        return words[word];
+    }
+
+    static void writeQuad(Vertex* quad, const GlyphQuad& glyph, Vector2f pen, Color color) {
+        float left = pen.x + glyph.bounds.left;
+        float top = pen.y + glyph.bounds.top;
+        float right = left + glyph.bounds.width;
+        float bottom = top + glyph.bounds.height;
+        float u0 = glyph.uv.left, v0 = glyph.uv.top;
+        float u1 = u0 + glyph.uv.width, v1 = v0 + glyph.uv.height;
+
+        quad[0] = Vertex(Vector2f(left, top), color, Vector2f(u0, v0));
+        quad[1] = Vertex(Vector2f(right, top), color, Vector2f(u1, v0));
+        quad[2] = Vertex(Vector2f(left, bottom), color, Vector2f(u0, v1));
+        quad[3] = Vertex(Vector2f(left, bottom), color, Vector2f(u0, v1));
+        quad[4] = Vertex(Vector2f(right, top), color, Vector2f(u1, v0));
+        quad[5] = Vertex(Vector2f(right, bottom), color, Vector2f(u1, v1));
+    }
+
+    const SizeTable* table(unsigned size) const {
+        for (int i = 0; i < SIZE_COUNT; i++) {
+            if (tables[i].size == size) return &tables[i];
+        }
+        return nullptr;
+    }
+
+    HudFont() : ready(false) {
+        static const unsigned sizes[SIZE_COUNT] = { 18, 24, 30, 36 };
+        for (int i = 0; i < SIZE_COUNT; i++) {
+            tables[i].size = sizes[i];
+        }
+    }
+
+public:
+    static HudFont& instance() {
+        static HudFont hud;
+        return hud;
+    }
+
+    // Uses its own Font so glyph loading here never races the render thread.
+    bool build(const string& fontFile) {
+        if (ready) return true;
+        if (!TextureLoader::tryLoadFont(font, fontFile)) {
+            LOG_ERROR(Log::Assets, "HUD font unavailable: %s", fontFile.c_str());
+            return false;
+        }
+
+        string charset = "0123456789/-";
+        for (int word = 0; word < WORD_COUNT; word++) {
+            for (const char* c = wordText(word); *c; c++) {
+                if (charset.find(*c) == string::npos) charset += *c;
+            }
+        }
+
+        // Shelf-pack every glyph of every size, then copy them out of the font pages.
+        struct Placement { int table; char c; IntRect source; int x, y; };
+        vector<Placement> placements;
+        int penX = 1, penY = 1, shelfHeight = 0;
+        for (int t = 0; t < SIZE_COUNT; t++) {
+            for (char c : charset) {
+                const Glyph& glyph = font.getGlyph((Uint32)c, tables[t].size, false);
+                GlyphQuad& quad = tables[t].glyphs[(int)c];
+                quad.bounds = glyph.bounds;
+                quad.advance = glyph.advance;
+                quad.present = true;
+                if (glyph.textureRect.width <= 0 || glyph.textureRect.height <= 0) continue;
+
+                if (penX + glyph.textureRect.width + 1 > ATLAS_WIDTH) {
+                    penX = 1;
+                    penY += shelfHeight + 1;
+                    shelfHeight = 0;
+                }
+                Placement placement = { t, c, glyph.textureRect, penX, penY };
+                placements.push_back(placement);
+                quad.uv = FloatRect((float)penX, (float)penY, (float)glyph.textureRect.width, (float)glyph.textureRect.height);
+                penX += glyph.textureRect.width + 1;
+                shelfHeight = max(shelfHeight, glyph.textureRect.height);
+            }
+        }
+
+        Image atlasImage;
+        atlasImage.create(ATLAS_WIDTH, penY + shelfHeight + 1, Color(255, 255, 255, 0));
+        for (int t = 0; t < SIZE_COUNT; t++) {
+            Image page = font.getTexture(tables[t].size).copyToImage();
+            for (const Placement& placement : placements) {
+                if (placement.table == t) {
+                    atlasImage.copy(page, placement.x, placement.y, placement.source);
+                }
+            }
+        }
+        if (!atlas.loadFromImage(atlasImage)) {
+            LOG_ERROR(Log::Assets, "Failed to upload HUD glyph atlas");
+            return false;
+        }
+
+        // Pre-kern every vocabulary word into a ready-made quad run.
+        for (int t = 0; t < SIZE_COUNT; t++) {
+            for (int word = 0; word < WORD_COUNT; word++) {
+                WordRun& run = tables[t].words[word];
+                float x = 0.f;
+                char previous = 0;
+                for (const char* c = wordText(word); *c; c++) {
+                    if (previous) x += font.getKerning((Uint32)previous, (Uint32)*c, tables[t].size);
+                    const GlyphQuad& glyph = tables[t].glyphs[(int)*c];
+                    if (glyph.uv.width > 0) {
+                        size_t start = run.vertices.size();
+                        run.vertices.resize(start + 6);
+                        writeQuad(&run.vertices[start], glyph, Vector2f(x, (float)tables[t].size), Color::White);
+                    }
+                    x += glyph.advance;
+                    previous = *c;
+                }
+                run.width = x;
+            }
+        }
+
+        ready = true;
+        LOG_INFO(Log::Assets, "HUD atlas built: %d glyphs, %dx%d", (int)placements.size(), ATLAS_WIDTH, penY + shelfHeight + 1);
+        return true;
+    }
+
+    // Emits one line of HUD text: words, digits and single characters.
+    class Line {
+    private:
+        RenderSnapshot& frame;
+        const HudFont& hud;
+        const SizeTable* table;
+        Vector2f pen;
+        Color color;
+
+    public:
+        Line(RenderSnapshot& f, unsigned size, Vector2f position, Color c) :
+            frame(f), hud(HudFont::instance()), table(HudFont::instance().table(size)), pen(position), color(c) {
+            if (!hud.ready) table = nullptr;
+        }
+
+        Line& word(Word id) {
+            if (!table) return *this;
+            const WordRun& run = table->words[id];
+            if (!run.vertices.empty()) {
+                Vertex* out = frame.appendVertices(&hud.atlas, run.vertices.size());
+                for (size_t i = 0; i < run.vertices.size(); i++) {
+                    out[i] = run.vertices[i];
+                    out[i].position += pen;
+                    out[i].color = color;
+                }
+            }
+            pen.x += run.width;
+            return *this;
+        }
+
+        Line& character(char c) {
+            if (!table || c < 0) return *this;
+            const GlyphQuad& glyph = table->glyphs[(int)c];
+            if (!glyph.present) return *this;
+            if (glyph.uv.width > 0) {
+                writeQuad(frame.appendVertices(&hud.atlas, 6), glyph, Vector2f(pen.x, pen.y + table->size), color);
+            }
+            pen.x += glyph.advance;
+            return *this;
+        }
+
+        Line& number(int value) {
+            char digits[12];
+            int count = 0;
+            unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+            do {
+                digits[count++] = (char)('0' + magnitude % 10);
+                magnitude /= 10;
+            } while (magnitude > 0);
+            if (value < 0) character('-');
+            while (count > 0) character(digits[--count]);
+            return *this;
+        }
+    };
+};
+
+// Owns the window's GL context on a dedicated thread. The game thread publishes
+// snapshots into a triple buffer and never waits on display(); the render thread
+// always draws the newest one and blends positions between the last two ticks.
+class Renderer {
+private:
+    static const int FRESH = 4;
+
+    RenderWindow& window;
+    thread* worker;
+    atomic<bool> running;
+    atomic<bool> closeRequested;
+    Clock clock;
+
+    RenderSnapshot snapshots[3];
+    int writeIndex;
+    int readIndex;
+    atomic<int> readyIndex; // Index of the newest published snapshot, FRESH if unread
+    unsigned long long publishedSequence;
+    atomic<unsigned long long> presentedSequence;
+    float lastTickTime;
+
+    struct TextCache {
+        vector<Text> labels;
+        vector<string> contents;
+    };
+
+    struct CachedLayer {
+        int id;
+        unsigned version;
+        RenderTexture* texture;
+        unsigned long long lastUsed;
+    };
+
+    static const unsigned long long LAYER_EXPIRY = 300; // Frames a layer may go undrawn before it is freed
+
+    // Render-thread only: text objects are re-laid out only when their string changes.
+    TextCache frameText;
+    TextCache layerText;
+    vector<CachedLayer> layerCache;
+    unsigned long long framesDrawn;
+    Sprite spriteBrush;
+    RectangleShape rectangleBrush;
+
+    bool acquire() {
+        if (!(readyIndex.load(memory_order_relaxed) & FRESH)) return false;
+        readIndex = readyIndex.exchange(readIndex, memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+
+    void drawCommands(RenderTarget& target, const RenderSnapshot& frame, float alpha, TextCache& cache) {
+        size_t textSlot = 0;
+
+        for (const RenderSnapshot::Command& command : frame.commands) {
+            Vector2f position = command.previousPosition + (command.position - command.previousPosition) * alpha;
+            switch (command.type) {
+            case RenderSnapshot::SPRITE:
+                spriteBrush.setTexture(*command.texture);
+                spriteBrush.setTextureRect(command.textureRect);
+                spriteBrush.setPosition(position);
+                spriteBrush.setScale(command.scale);
+                spriteBrush.setOrigin(command.origin);
+                spriteBrush.setRotation(command.rotation);
+                spriteBrush.setColor(command.color);
+                target.draw(spriteBrush);
+                break;
+            case RenderSnapshot::TEXT: {
+                if (textSlot == cache.labels.size()) {
+                    cache.labels.push_back(Text());
+                    cache.contents.push_back(string());
+                }
+                Text& label = cache.labels[textSlot];
+                string& content = cache.contents[textSlot];
+                textSlot++;
+
+                const char* value = frame.text.data() + command.textStart;
+                if (label.getFont() != command.font || label.getCharacterSize() != command.characterSize ||
+                    content.compare(0, string::npos, value, command.textLength) != 0) {
+                    content.assign(value, command.textLength);
+                    label.setFont(*command.font);
+                    label.setCharacterSize(command.characterSize);
+                    label.setString(content);
+                }
+                label.setFillColor(command.color);
+                label.setPosition(position.x - label.getLocalBounds().width * command.anchor, position.y);
+                target.draw(label);
+                break;
+            }
+            case RenderSnapshot::RECTANGLE:
+                rectangleBrush.setSize(command.size);
+                rectangleBrush.setPosition(position);
+                rectangleBrush.setFillColor(command.color);
+                target.draw(rectangleBrush);
+                break;
+            case RenderSnapshot::LAYER:
+                drawLayer(command, *frame.layers[command.layerIndex]);
+                break;
+            case RenderSnapshot::VERTICES:
+                target.draw(&frame.vertices[command.vertexStart], command.vertexCount, Triangles, RenderStates(command.texture));
+                break;
+            }
+        }
+    }
+
+    // Re-renders the layer only when its version or the window size changed,
+    // then composites it with one full-view quad.
+    void drawLayer(const RenderSnapshot::Command& command, const RenderSnapshot& content) {
+        CachedLayer* layer = nullptr;
+        for (CachedLayer& cached : layerCache) {
+            if (cached.id == command.layerId) layer = &cached;
+        }
+        if (!layer) {
+            CachedLayer cached = { command.layerId, 0, nullptr, 0 };
+            layerCache.push_back(cached);
+            layer = &layerCache.back();
+        }
+        layer->lastUsed = framesDrawn;
+
+        Vector2u size = window.getSize();
+        if (!layer->texture || layer->texture->getSize() != size) {
+            delete layer->texture;
+            layer->texture = new RenderTexture();
+            layer->texture->create(size.x, size.y);
+            layer->version = 0;
+        }
+
+        if (layer->version != command.layerVersion) {
+            layer->texture->setView(window.getView());
+            layer->texture->clear(Color::Transparent);
+            drawCommands(*layer->texture, content, 1.f, layerText);
+            layer->texture->display();
+            layer->version = command.layerVersion;
+        }
+
+        const View& view = window.getView();
+        spriteBrush.setTexture(layer->texture->getTexture(), true);
+        spriteBrush.setPosition(view.getCenter() - view.getSize() * 0.5f);
+        spriteBrush.setScale(view.getSize().x / size.x, view.getSize().y / size.y);
+        spriteBrush.setOrigin(0.f, 0.f);
+        spriteBrush.setRotation(0.f);
+        spriteBrush.setColor(Color::White);
+        window.draw(spriteBrush);
+    }
+
+    void releaseStaleLayers() {
+        for (size_t i = 0; i < layerCache.size();) {
+            if (framesDrawn - layerCache[i].lastUsed > LAYER_EXPIRY) {
+                delete layerCache[i].texture;
+                layerCache[i] = layerCache.back();
+                layerCache.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    void drawSnapshot(const RenderSnapshot& frame, float alpha) {
+        window.clear(frame.clearColor);
+        drawCommands(window, frame, alpha, frameText);
+        framesDrawn++;
+        releaseStaleLayers();
+    }
+
+    void renderLoop() {
+        window.setActive(true);
+        unsigned long long drawnSequence = 0;
+        float drawnAlpha = 0.f;
+
+        while (running.load(memory_order_acquire)) {
+            acquire();
+            const RenderSnapshot& frame = snapshots[readIndex];
+
+            float alpha = (clock.getElapsedTime().asSeconds() - frame.tickTime) / frame.tickStep;
+            alpha = min(1.f, max(0.f, alpha));
+
+            // Nothing new and fully blended: don't burn a core re-presenting the same image.
+            bool idle = frame.blank || (frame.sequence == drawnSequence && drawnAlpha >= 1.f);
+            if (idle) {
+                presentedSequence.store(frame.sequence, memory_order_release);
+                TextureCache::instance().presented(frame.sequence);
+                sleep(milliseconds(1));
+                continue;
+            }
+
+            drawSnapshot(frame, alpha);
+            window.display();
+            StartupTrace::firstFrame();
+            InputSystem::instance().presented(frame.inputArrival);
+            drawnSequence = frame.sequence;
+            drawnAlpha = alpha;
+            presentedSequence.store(frame.sequence, memory_order_release);
+            TextureCache::instance().presented(frame.sequence);
+        }
+
+        for (CachedLayer& layer : layerCache) {
+            delete layer.texture;
+        }
+        layerCache.clear();
+        window.setActive(false);
+    }
+
+public:
+    explicit Renderer(RenderWindow& w) :
+        window(w), worker(nullptr), running(false), closeRequested(false),
+        writeIndex(0), readIndex(1), readyIndex(2), publishedSequence(0), presentedSequence(0), lastTickTime(0.f), framesDrawn(0) {
+    }
+
+    ~Renderer() {
+        stop();
+    }
+
+    void start() {
+        if (running.exchange(true)) return;
+        window.setActive(false);
+        worker = new thread(&Renderer::renderLoop, this);
+    }
+
+    void stop() {
+        if (!running.exchange(false)) return;
+        worker->join();
+        delete worker;
+        worker = nullptr;
+        window.setActive(true);
+    }
+
+    RenderSnapshot& beginFrame() {
+        RenderSnapshot& frame = snapshots[writeIndex];
+        frame.reset();
+        return frame;
+    }
+
+    // tickStep is the logic tick length; the render thread blends over it. Frames
+    // published between ticks (to show input early) keep the last tick's time.
+    void publish(float tickStep, bool newTick = true) {
+        RenderSnapshot& frame = snapshots[writeIndex];
+        frame.sequence = ++publishedSequence;
+        if (newTick) lastTickTime = clock.getElapsedTime().asSeconds();
+        frame.tickTime = lastTickTime;
+        frame.tickStep = tickStep;
+        frame.inputArrival = InputSystem::instance().pendingArrival();
+        TextureCache::instance().published(frame.sequence);
+        writeIndex = readyIndex.exchange(writeIndex | FRESH, memory_order_acq_rel) & ~FRESH;
+    }
+
+    // Call before destroying textures or fonts a published snapshot may point at:
+    // returns once the render thread has moved past every earlier snapshot.
+    void flush() {
+        RenderSnapshot& frame = beginFrame();
+        frame.blank = true;
+        publish(1.f);
+        while (running.load(memory_order_acquire) &&
+            presentedSequence.load(memory_order_acquire) < publishedSequence) {
+            sleep(milliseconds(1));
+        }
+    }
+
+    void requestClose() { closeRequested = true; }
+    bool isOpen() const { return window.isOpen() && !closeRequested; }
+    RenderWindow& getWindow() { return window; }
+};
+
+class SceneStack;
+
+// One screen of the game. Scenes are built once and reused: the owner resets a
+// scene for each visit, SceneStack calls prepare() until it is ready, and the
+// scene calls finish() when it is done, which pops it and resumes the one below.
+class Scene {
+private:
+    friend class SceneStack;
+    bool finished;
+    int result;
+
+protected:
+    SceneStack* stack; // Set while the scene is on the stack
+
+    void finish(int value = 0) {
+        finished = true;
+        result = value;
+    }
+
+public:
+    Scene() : finished(false), result(0), stack(nullptr) {}
+    virtual ~Scene() {}
+
+    virtual void handleInput(const InputSystem::Input& input) = 0;
+    virtual void tick(float dt) = 0;
+    virtual void buildFrame(RenderSnapshot& frame) = 0;
+    virtual const char* sceneName() const = 0;
+
+    // Called once per tick before the scene is pushed, while the outgoing scene
+    // keeps running and drawing. Do one slice of loading per call; true when ready.
+    virtual bool prepare() { return true; }
+
+    // A scene pushed on top of this one has finished.
+    virtual void resume(Scene& finishedScene, int finishedResult) {}
+};
+
+// The one main loop: poll input, run the owed fixed ticks on the top scene, then
+// publish a snapshot for the render thread. A frame that handled input is
+// published straight away instead of waiting for the next tick.
+class SceneStack {
+private:
+    static const int MAX_DEPTH = 8;
+    static const int STEADY_AFTER = 30; // Frames without input before a frame counts as steady
+
+    Renderer& renderer;
+    FixedTimestep timestep;
+    Scene* scenes[MAX_DEPTH];
+    int depth;
+    Scene* incoming; // Preparing; pushed once prepare() says it is ready
+    Uint64 incomingArrival; // Input that asked for the push; it shows once the push lands
+    int frameLimit; // Stop after this many published frames; -1 for no limit
+
+    Scene* top() const { return depth > 0 ? scenes[depth - 1] : nullptr; }
+
+    const char* topName() const { return depth > 0 ? scenes[depth - 1]->sceneName() : "none"; }
+
+    void popFinished() {
+        while (depth > 0 && scenes[depth - 1]->finished) {
+            Scene* done = scenes[--depth];
+            done->stack = nullptr;
+            LOG_DEBUG(Log::Game, "Scene %s finished (%d)", done->sceneName(), done->result);
+            if (depth > 0) scenes[depth - 1]->resume(*done, done->result);
+        }
+    }
+
+    void advanceTransition() {
+        if (!incoming || !incoming->prepare()) return;
+        if (depth == MAX_DEPTH) {
+            LOG_ERROR(Log::Game, "Scene stack full, dropping %s", incoming->sceneName());
+            incoming = nullptr;
+            return;
+        }
+        incoming->finished = false;
+        incoming->result = 0;
+        incoming->stack = this;
+        scenes[depth++] = incoming;
+        incoming = nullptr;
+        if (incomingArrival) InputSystem::instance().handled(incomingArrival);
+        incomingArrival = 0;
+    }
+
+public:
+    explicit SceneStack(Renderer& r) : renderer(r), depth(0), incoming(nullptr), incomingArrival(0), frameLimit(-1) {}
+
+    // Takes effect once the scene's prepare() returns true. One push at a time.
+    void push(Scene& scene) {
+        if (incoming) LOG_WARN(Log::Game, "Scene %s replaces pending %s", scene.sceneName(), incoming->sceneName());
+        incoming = &scene;
+    }
+
+    void clear() {
+        while (depth > 0) scenes[--depth]->stack = nullptr;
+        incoming = nullptr;
+        incomingArrival = 0;
+    }
+
+    // For checks that idle a scene for a fixed number of frames.
+    void limitFrames(int frames) { frameLimit = frames; }
+
+    // Runs until the stack empties; returns false if the window was closed.
+    // Input waits in the queue while a scene is preparing, so it reaches the
+    // scene it was meant for.
+    bool run() {
+        InputSystem& inputs = InputSystem::instance();
+        timestep.reset();
+        int framesPublished = 0;
+        int quietFrames = 0;
+        while (renderer.isOpen() && (depth > 0 || incoming)) {
+            ALLOC_FRAME_BEGIN();
+            inputs.poll(renderer.getWindow());
+            bool handled = false;
+            InputSystem::Input input;
+            while (!incoming && depth > 0 && inputs.next(input)) {
+                if (input.action == InputSystem::QUIT) {
+                    renderer.requestClose();
+                    ALLOC_FRAME_END(topName(), false);
+                    return false;
+                }
+                {
+                    ALLOC_ZONE("handleInput");
+                    top()->handleInput(input);
+                }
+                popFinished();
+                // Frames of the outgoing scene don't show a push yet.
+                if (incoming) incomingArrival = input.arrival;
+                else inputs.handled(input.arrival);
+                handled = true;
+                quietFrames = 0;
+            }
+
+            int steps = timestep.advance();
+            for (int i = 0; i < steps && (depth > 0 || incoming); i++) {
+                ALLOC_ZONE("tick");
+                advanceTransition();
+                if (depth == 0) continue;
+                top()->tick(timestep.getStep());
+                popFinished();
+            }
+            if (depth == 0 || timestep.isUnthrottled()) {
+                ALLOC_FRAME_END(topName(), false);
+                if (depth == 0) sleep(milliseconds(1));
+                continue;
+            }
+
+            if (steps > 0 || handled) {
+                {
+                    ALLOC_ZONE("buildFrame");
+                    top()->buildFrame(renderer.beginFrame());
+                }
+                {
+                    ALLOC_ZONE("Renderer::publish");
+                    renderer.publish(timestep.getStep(), steps > 0);
+                }
+                ALLOC_FRAME_END(topName(), ++quietFrames > STEADY_AFTER && !incoming);
+                if (frameLimit >= 0 && ++framesPublished >= frameLimit) break;
+            }
+            else {
+                ALLOC_FRAME_END(topName(), false);
+                sleep(milliseconds(1));
+            }
+        }
+        return renderer.isOpen();
+    }
+};
+
+// Game randomness (xorshift64*). Each thread has its own generator, so
+// headless runs on worker threads replay exactly from their seed.
+class Random {
+private:
+    Uint64 state;
+
+public:
+    explicit Random(Uint64 seed = 0) { reseed(seed); }
+
+    void reseed(Uint64 seed) {
+        // splitmix64 spreads nearby seeds apart; the state must not be zero
+        seed += 0x9E3779B97F4A7C15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+        state = (seed ^ (seed >> 31)) | 1;
+    }
+
+    Uint64 next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // Uniform in [0, n)
+    int below(int n) { return (int)((next() >> 33) % (Uint64)n); }
+
+    template <class T>
+    void shuffle(vector<T>& items) {
+        for (int i = (int)items.size() - 1; i > 0; i--) {
+            swap(items[i], items[below(i + 1)]);
+        }
+    }
+
+    static Random& local() {
+        thread_local Random random;
+        return random;
+    }
+};
+
+// Daily challenge: one published seed fixes the enemies at every map node,
+// so everyone fights the same battles that day. When a run starts, the game
+// thread's generator is reseeded from it too, so card shuffles and attack rolls
+// start the same way on every launch and retry; they still diverge with the
+// player's choices. Seeds are screened by SeedVerifier before they are published.
+class DailyChallenge {
+private:
+    Uint64 seed; // 0 when not playing a daily
+
+    DailyChallenge() : seed(0) {}
+
+public:
+    static DailyChallenge& instance() {
+        static DailyChallenge challenge;
+        return challenge;
+    }
+
+    // Local date as yyyymmdd.
+    static int today() {
+        time_t now = time(nullptr);
+        tm local = *localtime(&now);
+        return (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+    }
+
+    // Candidate seeds for a date; the game plays candidate 0 unless given a published seed.
+    static Uint64 seedFor(int date, int candidate = 0) {
+        Random random((Uint64)date * 1000003ULL + (Uint64)candidate);
+        return random.next() | 1; // Never 0, which means no daily
+    }
+
+    // Enemy rolls for a node, independent of everything before it in the run.
+    static Random encounters(Uint64 seed, int node) {
+        return Random(seed ^ ((Uint64)(node + 1) << 48));
+    }
+
+    void select(Uint64 dailySeed) { seed = dailySeed; }
+
+    // Game thread, as a run begins.
+    void start() {
+        if (seed) Random::local().reseed(seed);
+    }
+
+    bool isActive() const { return seed != 0; }
+    Uint64 getSeed() const { return seed; }
+};
+
+// Spell bursts, hit sparks and heal motes. Particles live in parallel arrays
+// (structure of arrays) sized once up front, so an update is a few straight
+// loops over floats that the compiler can vectorise, and spawning never
+// allocates. A dead particle is replaced by the last live one. Everything is
+// drawn as one triangle batch with a soft dot texture.
+class ParticleSystem {
+public:
+    enum Effect { SPELL_BURST, HIT_SPARK, HEAL_MOTE, EFFECT_COUNT };
+
+    static const int CAPACITY = 1 << 17;
+
+private:
+    struct Style {
+        int count;
+        float speed;
+        float life;
+        float gravity; // Pixels per second squared, down is positive
+        float size;
+        Color color;
+    };
+
+    static const Style& style(int effect) {
+        static const Style styles[EFFECT_COUNT] = {
+            { 160, 220.f, 0.7f, 60.f, 5.f, Color(170, 90, 255) },   // Spell burst
+            { 40, 320.f, 0.35f, 500.f, 3.f, Color(255, 210, 120) }, // Hit spark
+            { 60, 60.f, 1.1f, -90.f, 4.f, Color(120, 255, 140) }    // Heal mote
+        };
+        return styles[effect];
+    }
+
+    static const int DOT_SIZE = 16;
+    const float DRAG = 0.15f; // Fraction of velocity kept per second
+
+    vector<float> x;
+    vector<float> y;
+    vector<float> vx;
+    vector<float> vy;
+    vector<float> gravity;
+    vector<float> life; // Seconds left
+    vector<float> fade; // 1 / starting life
+    vector<float> size;
+    vector<Color> color;
+    int live;
+    Random random; // Visual only, so gameplay rolls are unaffected
+    Texture dot;
+
+    float unit() { return (float)(random.next() >> 40) / (float)(1 << 24); }
+
+public:
+    ParticleSystem() : live(0), random(0x5EED) {
+        x.resize(CAPACITY);
+        y.resize(CAPACITY);
+        vx.resize(CAPACITY);
+        vy.resize(CAPACITY);
+        gravity.resize(CAPACITY);
+        life.resize(CAPACITY);
+        fade.resize(CAPACITY);
+        size.resize(CAPACITY);
+        color.resize(CAPACITY);
+
+        Image image;
+        image.create(DOT_SIZE, DOT_SIZE, Color::Transparent);
+        float radius = DOT_SIZE / 2.f;
+        for (int row = 0; row < DOT_SIZE; row++) {
+            for (int column = 0; column < DOT_SIZE; column++) {
+                float dx = column + 0.5f - radius, dy = row + 0.5f - radius;
+                float falloff = max(0.f, 1.f - sqrt(dx * dx + dy * dy) / radius);
+                image.setPixel(column, row, Color(255, 255, 255, (Uint8)(255 * falloff * falloff)));
+            }
+        }
+        dot.loadFromImage(image);
+        dot.setSmooth(true);
+    }
+
+    // Spawns an effect's particles around a point; extra ones are dropped when full.
+    void emit(Effect effect, Vector2f at, int count = 0) {
+        const Style& look = style(effect);
+        if (count <= 0) count = look.count;
+        count = min(count, CAPACITY - live);
+        for (int i = live; i < live + count; i++) {
+            float angle = unit() * 6.2831853f;
+            float speed = look.speed * (0.3f + 0.7f * unit());
+            x[i] = at.x + (unit() - 0.5f) * 20.f;
+            y[i] = at.y + (unit() - 0.5f) * 20.f;
+            vx[i] = cos(angle) * speed;
+            vy[i] = sin(angle) * speed;
+            gravity[i] = look.gravity;
+            life[i] = look.life * (0.6f + 0.4f * unit());
+            fade[i] = 1.f / life[i];
+            size[i] = look.size * (0.5f + unit());
+            color[i] = look.color;
+        }
+        live += count;
+    }
+
+    void update(float dt) {
+        float keep = pow(DRAG, dt);
+        float* px = x.data();
+        float* py = y.data();
+        float* pvx = vx.data();
+        float* pvy = vy.data();
+        float* pgravity = gravity.data();
+        float* plife = life.data();
+
+        for (int i = 0; i < live; i++) {
+            pvx[i] *= keep;
+            pvy[i] = pvy[i] * keep + pgravity[i] * dt;
+        }
+        for (int i = 0; i < live; i++) {
+            px[i] += pvx[i] * dt;
+            py[i] += pvy[i] * dt;
+            plife[i] -= dt;
+        }
+
+        for (int i = 0; i < live;) {
+            if (plife[i] > 0.f) {
+                i++;
+                continue;
+            }
+            live--;
+            x[i] = x[live];
+            y[i] = y[live];
+            vx[i] = vx[live];
+            vy[i] = vy[live];
+            gravity[i] = gravity[live];
+            life[i] = life[live];
+            fade[i] = fade[live];
+            size[i] = size[live];
+            color[i] = color[live];
+        }
+    }
+
+    void clear() { live = 0; }
+    int count() const { return live; }
+
+    // Two triangles per particle, faded by remaining life.
+    void draw(RenderSnapshot& frame) const {
+        if (!live) return;
+        Vertex* vertices = frame.appendVertices(&dot, (size_t)live * 6);
+        const Vector2f corners[4] = {
+            Vector2f(0.f, 0.f), Vector2f((float)DOT_SIZE, 0.f),
+            Vector2f((float)DOT_SIZE, (float)DOT_SIZE), Vector2f(0.f, (float)DOT_SIZE)
+        };
+        for (int i = 0; i < live; i++) {
+            float half = size[i];
+            Color tint = color[i];
+            tint.a = (Uint8)(tint.a * min(1.f, life[i] * fade[i] * 2.f));
+            Vector2f topLeft(x[i] - half, y[i] - half), bottomRight(x[i] + half, y[i] + half);
+            Vertex* quad = vertices + i * 6;
+            quad[0] = Vertex(topLeft, tint, corners[0]);
+            quad[1] = Vertex(Vector2f(bottomRight.x, topLeft.y), tint, corners[1]);
+            quad[2] = Vertex(bottomRight, tint, corners[2]);
+            quad[3] = quad[0];
+            quad[4] = quad[2];
+            quad[5] = Vertex(Vector2f(topLeft.x, bottomRight.y), tint, corners[3]);
+        }
+    }
+};
+
+// Walker's alias method (Vose's construction): a discrete distribution laid
+// out as n columns, each split between its own outcome and one alias, so a
+// draw is one random number however many outcomes there are.
+class AliasTable {
+private:
+    static const Uint64 ALWAYS = 1ULL << 32;
+
+    vector<Uint64> keep; // Out of 2^32: below this the column's own outcome wins
+    vector<int> alias;
+
+public:
+    // Weights must be non-negative with a positive total.
+    void build(const vector<double>& weights) {
+        int n = (int)weights.size();
+        keep.assign(n, (Uint64)ALWAYS);
+        alias.assign(n, 0);
+        double total = 0.0;
+        for (double weight : weights) total += weight;
+        if (n == 0 || total <= 0.0) return;
+
+        vector<double> scaled(n);
+        vector<int> small, large;
+        for (int i = 0; i < n; i++) {
+            alias[i] = i;
+            scaled[i] = weights[i] * n / total;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int under = small.back();
+            small.pop_back();
+            int over = large.back();
+            keep[under] = (Uint64)(scaled[under] * ALWAYS);
+            alias[under] = over;
+            scaled[over] -= 1.0 - scaled[under];
+            if (scaled[over] < 1.0) {
+                large.pop_back();
+                small.push_back(over);
+            }
+        }
+        // Whatever is left is 1 up to rounding and keeps its own outcome.
+    }
+
+    bool empty() const { return keep.empty(); }
+    int size() const { return (int)keep.size(); }
+
+    int sample(Random& random) const {
+        Uint64 bits = random.next();
+        int column = (int)(((bits >> 32) * (Uint64)keep.size()) >> 32);
+        return (bits & 0xFFFFFFFFULL) < keep[column] ? column : alias[column];
+    }
+};
+
+// Which enemies a battle at a map node starts with, read from encounters.txt.
+// Nodes are grouped into tiers; each tier draws its group size and enemy
+// types from weighted tables, can fill elite slots from a table of their own,
+// and can pin a boss to the first slot. All tables are alias tables, so
+// rolling an encounter costs the same however large the bestiary gets.
+// Reads a whole file into text. False if it can't be opened.
+static bool readTextFile(const string& path, string& text) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, count);
+    }
+    fclose(file);
+    return true;
+}
+
+// The block format shared by the rule files: "<kind> ..." opens a block and
+// "end" closes it, with one keyword per line in between. Blank lines and '#'
+// comments are skipped; bad lines are reported and skipped.
+class RuleFile {
+private:
+    const char* kind;
+    Log::Category category;
+
+protected:
+    RuleFile(const char* blockKind, Log::Category logCategory) : kind(blockKind), category(logCategory) {}
+    virtual ~RuleFile() {}
+
+    // The words after the block keyword. False drops the block; say why.
+    virtual bool beginBlock(istringstream& words, const char* source, int lineNumber) = 0;
+    // False if the line can't be read.
+    virtual bool readLine(const string& key, istringstream& words) = 0;
+    virtual void endBlock(const char* source) = 0;
+    virtual const string& blockName() const = 0;
+
+    // False, with an error logged, if the file can't be read.
+    bool parseFile(const string& file) {
+        string text;
+        if (!readTextFile(file, text)) {
+            LOG_ERROR(category, "Cannot read %s", file.c_str());
+            return false;
+        }
+
+        const char* source = file.c_str();
+        istringstream lines(text);
+        string line;
+        int lineNumber = 0;
+        bool inBlock = false;
+
+        while (getline(lines, line)) {
+            lineNumber++;
+            istringstream words(line);
+            string key;
+            if (!(words >> key) || key[0] == '#') continue;
+
+            if (key == kind) {
+                inBlock = beginBlock(words, source, lineNumber);
+                continue;
+            }
+            if (!inBlock) {
+                LOG_WARN(category, "%s:%d: '%s' outside a %s block", source, lineNumber, key.c_str(), kind);
+                continue;
+            }
+            if (key == "end") {
+                inBlock = false;
+                endBlock(source);
+            }
+            else if (!readLine(key, words)) {
+                LOG_WARN(category, "%s:%d: cannot read '%s'", source, lineNumber, line.c_str());
+            }
+        }
+        if (inBlock) LOG_WARN(category, "%s: %s %s has no 'end'", source, kind, blockName().c_str());
+        return true;
+    }
+};
+
+class EncounterTable : private RuleFile {
+public:
+    static const int ENEMY_TYPES = 3; // cronie, captain, boss; stats are in BattleState
+    static const int MAX_GROUP = 4;
+
+private:
+    struct Tier {
+        string name;
+        int firstNode;
+        int lastNode;
+        int boss;       // Type in the first slot, -1 for none
+        int eliteSlots; // Slots after the boss drawn from the elite table
+        vector<int> sizes;
+        vector<double> sizeWeights;
+        vector<int> types;
+        vector<double> typeWeights;
+        vector<int> elites;
+        vector<double> eliteWeights;
+        AliasTable sizeTable;
+        AliasTable typeTable;
+        AliasTable eliteTable;
+    };
+
+    vector<Tier> tiers;
+    Tier tier; // Block being read
+
+    static int typeByName(const string& name) {
+        static const char* names[ENEMY_TYPES] = { "cronie", "captain", "boss" };
+        for (int i = 0; i < ENEMY_TYPES; i++) {
+            if (name == names[i]) return i;
+        }
+        return -1;
+    }
+
+    bool beginBlock(istringstream& words, const char* source, int lineNumber) override {
+        tier = Tier();
+        tier.boss = -1;
+        tier.eliteSlots = 0;
+        bool ok = (bool)(words >> tier.name >> tier.firstNode >> tier.lastNode) && tier.firstNode <= tier.lastNode;
+        if (!ok) LOG_WARN(Log::Combat, "%s:%d: expected 'tier <name> <first node> <last node>'", source, lineNumber);
+        return ok;
+    }
+
+    bool readLine(const string& key, istringstream& words) override {
+        bool ok = true;
+        string name;
+        double weight = 1.0;
+        if (key == "size") {
+            int size = 0;
+            ok = (bool)(words >> size) && size >= 1 && size <= MAX_GROUP;
+            if (ok && words >> weight) ok = weight > 0.0;
+            if (ok) {
+                tier.sizes.push_back(size);
+                tier.sizeWeights.push_back(weight);
+            }
+        }
+        else if (key == "enemy" || key == "elite") {
+            ok = (bool)(words >> name >> weight) && typeByName(name) >= 0 && weight > 0.0;
+            if (ok) {
+                (key == "enemy" ? tier.types : tier.elites).push_back(typeByName(name));
+                (key == "enemy" ? tier.typeWeights : tier.eliteWeights).push_back(weight);
+            }
+        }
+        else if (key == "elites") ok = (bool)(words >> tier.eliteSlots) && tier.eliteSlots >= 0;
+        else if (key == "boss") {
+            ok = (bool)(words >> name) && typeByName(name) >= 0;
+            if (ok) tier.boss = typeByName(name);
+        }
+        else ok = false;
+        return ok;
+    }
+
+    void endBlock(const char* source) override {
+        if (tier.sizes.empty() || (tier.types.empty() && tier.elites.empty())) {
+            LOG_WARN(Log::Combat, "%s: tier %s needs a size and an enemy, dropped", source, tier.name.c_str());
+            return;
+        }
+        // A tier with only one of the two tables uses it for every slot.
+        if (tier.types.empty()) {
+            tier.types = tier.elites;
+            tier.typeWeights = tier.eliteWeights;
+        }
+        if (tier.elites.empty()) {
+            tier.elites = tier.types;
+            tier.eliteWeights = tier.typeWeights;
+        }
+        tier.sizeTable.build(tier.sizeWeights);
+        tier.typeTable.build(tier.typeWeights);
+        tier.eliteTable.build(tier.eliteWeights);
+        tiers.push_back(tier);
+    }
+
+    const string& blockName() const override { return tier.name; }
+
+    // The tier covering the node, else the last one starting before it.
+    const Tier& tierFor(int node) const {
+        const Tier* best = &tiers[0];
+        for (const Tier& tier : tiers) {
+            if (node >= tier.firstNode && node <= tier.lastNode) return tier;
+            if (tier.firstNode <= node && tier.firstNode >= best->firstNode) best = &tier;
+        }
+        return *best;
+    }
+
+    EncounterTable() : RuleFile("tier", Log::Combat) {}
+
+public:
+    static EncounterTable& instance() {
+        static EncounterTable table;
+        return table;
+    }
+
+    // Reads the tiers file. There is no built-in set: false, with no tiers, if
+    // the file is missing or has no usable tier.
+    bool load(const string& file) {
+        tiers.clear();
+        if (!parseFile(file)) return false;
+        if (tiers.empty()) {
+            LOG_ERROR(Log::Combat, "No encounter tiers in %s", file.c_str());
+            return false;
+        }
+        LOG_INFO(Log::Combat, "Loaded %d encounter tiers", (int)tiers.size());
+        return true;
+    }
+
+    // Enemy types for a battle at the node, returns how many.
+    int roll(int node, Random& random, int types[MAX_GROUP]) const {
+        const Tier& tier = tierFor(node);
+        int count = tier.sizes[tier.sizeTable.sample(random)];
+        int slot = 0;
+        if (tier.boss >= 0) types[slot++] = tier.boss;
+        for (int elite = 0; elite < tier.eliteSlots && slot < count; elite++) {
+            types[slot++] = tier.elites[tier.eliteTable.sample(random)];
+        }
+        while (slot < count) {
+            types[slot++] = tier.types[tier.typeTable.sample(random)];
+        }
+        return count;
+    }
+};
+
+// Combat numbers for one battle, without sprites or animation. Cards run
+// against this, so a battle position can be copied and replayed cheaply.
+struct BattleState {
+    static const int MAX_ENEMIES = 4;
+
+    // Status effects: one bitset per effect (bit = entity) with value and
+    // turns left in parallel arrays. Entity 0 is the player, 1+ the enemies.
+    enum Status { POWER, EXHAUST, STATUS_COUNT };
+    static const int PLAYER = 0;
+    static const int ENTITIES = 1 + MAX_ENEMIES;
+
+    int playerHP;
+    int playerMaxHP;
+    int enemyCount;
+    int enemyHP[MAX_ENEMIES];
+    int enemyType[MAX_ENEMIES];
+    bool enemyAlive[MAX_ENEMIES];
+    unsigned usedOnce; // One bit per card definition
+
+    unsigned statusActive[STATUS_COUNT];
+    int statusValue[STATUS_COUNT][ENTITIES];
+    int statusTurns[STATUS_COUNT][ENTITIES];
+
+    static int lowestBit(unsigned bits) {
+        int index = 0;
+        while (!(bits & 1u)) {
+            bits >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+    int firstAliveEnemy() const {
+        for (int i = 0; i < enemyCount; i++) {
+            if (enemyAlive[i]) return i;
+        }
+        return -1;
+    }
+
+    void damageEnemy(int index, int amount) {
+        if (index < 0 || !enemyAlive[index]) return;
+        enemyHP[index] -= amount;
+        if (enemyHP[index] <= 0) {
+            enemyAlive[index] = false;
+            for (int s = 0; s < STATUS_COUNT; s++) {
+                statusActive[s] &= ~(1u << (1 + index));
+            }
+        }
+    }
+
+    int statusOf(int status, int entity) const {
+        return (statusActive[status] >> entity & 1u) ? statusValue[status][entity] : 0;
+    }
+
+    // Reapplying stacks the value and keeps the longer duration.
+    void applyStatus(int status, int entity, int value, int turns) {
+        if (turns <= 0) return;
+        unsigned bit = 1u << entity;
+        if (statusActive[status] & bit) {
+            statusValue[status][entity] += value;
+            statusTurns[status][entity] = max(statusTurns[status][entity], turns);
+        }
+        else {
+            statusActive[status] |= bit;
+            statusValue[status][entity] = value;
+            statusTurns[status][entity] = turns;
+        }
+    }
+
+    // Once per turn boundary; only visits effects that are active.
+    void tickStatuses() {
+        for (int s = 0; s < STATUS_COUNT; s++) {
+            for (unsigned bits = statusActive[s]; bits; bits &= bits - 1) {
+                int entity = lowestBit(bits);
+                if (--statusTurns[s][entity] <= 0) statusActive[s] &= ~(1u << entity);
+            }
+        }
+    }
+
+    // Enemy stats by type (cronie, captain, boss). Attacks roll uniformly in [min, max].
+    static int enemyMaxHP(int type) { return type == 0 ? 5 : type == 1 ? 7 : 15; }
+    static int coinReward(int type) { return type == 0 ? 15 : type == 1 ? 25 : 50; }
+    static int attackMin(int type) { return type == 0 ? 1 : 0; }
+    static int attackMax(int type) { return type == 0 ? 1 : type == 1 ? 2 : 4; }
+    static int rollAttack(int type, Random& random) {
+        return attackMin(type) + random.below(attackMax(type) - attackMin(type) + 1);
+    }
+
+    static const int VICTORY_COINS = 50;
+
+    // Line-up for a battle entered from map node `node`, from EncounterTable.
+    void spawnEnemies(int node, Random& random) {
+        enemyCount = EncounterTable::instance().roll(node, random, enemyType);
+        for (int i = 0; i < enemyCount; i++) {
+            enemyHP[i] = enemyMaxHP(enemyType[i]);
+            enemyAlive[i] = true;
+        }
+    }
+
+    // An exhausted enemy hits for less.
+    int enemyDamage(int index, int rolled) const {
+        return max(0, rolled - statusOf(EXHAUST, 1 + index));
+    }
+
+    float expectedEnemyDamage(int index) const {
+        int low = attackMin(enemyType[index]), high = attackMax(enemyType[index]);
+        int total = 0;
+        for (int roll = low; roll <= high; roll++) {
+            total += enemyDamage(index, roll);
+        }
+        return (float)total / (high - low + 1);
+    }
+
+    void healPlayer(int amount) {
+        playerHP = min(playerMaxHP, playerHP + amount);
+    }
+};
+
+class Player {
+private:
+    int HP;
+    int coins;
+    int maxHP;
+    int currentMana;
+    int maxMana;
+    Sprite sprite;
+    int animator;
+
+public:
+    Player() : HP(25), coins(100), maxHP(25), currentMana(5), maxMana(5) {
+        animator = Animation::create(sprite, Animation::characterClips("player standing.png", "player dying.png"));
+        sprite.setScale(2.f, 2.f);
+    }
+
+    Player(const Player&) = delete;
+    Player& operator=(const Player&) = delete;
+
+    ~Player() {
+        Animation::destroy(animator);
+    }
+
+    void reset() {
+        HP = 25;
+        coins = 100;
+        maxHP = 25;
+        currentMana = 5;
+        maxMana = 5;
+        Animation::destroy(animator);
+        animator = Animation::create(sprite, Animation::characterClips("player standing.png", "player dying.png"));
+    }
+
+    int getHP() const { return HP; }
+    int getCoins() const { return coins; }
+    void decHP() { HP--; }
+    void buy(int cardVal) { coins -= cardVal; }
+    void takeDMG(int val) {
+        HP -= val;
+        if (HP <= 0) Animation::play(animator, Animation::DYING);
+    }
+    void heal(int val) {
+        HP = HP + val;
+        if (HP > maxHP) HP = maxHP;
+        Animation::play(animator, Animation::HEAL);
+    }
+    void increaseCoins(int val) { coins += val; }
+    int getCurrentMana() const { return currentMana; }
+    int getMaxMana() const { return maxMana; }
+    void spendMana(int amount) { currentMana -= amount; }
+    void resetMana() { currentMana = maxMana; }
+    void increaseMaxMana(int amount) { maxMana += amount; }
+    int getMaxHP() { return maxHP; }
+    void setMaxHP(int val) { maxHP = val; }
+    void setHP(int val) { HP = val; }
+    void setMaxMana(int val) { maxMana = val; }
+    void setCurrentMana(int val) { currentMana = val; }
+    void playAttack() { Animation::play(animator, Animation::ATTACK); }
+
+    Sprite& getSprite() { return sprite; }
+    bool isAlive() const { return HP > 0; }
+};
+
+class Enemy {
+protected:
+    int HP;
+    bool alive;
+    int enemyType; // 0 = cronie, 1 = captain, 2 = boss
+    Sprite sprite;
+    int animator;
+
+    void setupAnimation() {
+        animator = Animation::create(sprite, Animation::characterClips(sheet(enemyType, false), sheet(enemyType, true)));
+        sprite.setScale(-2.f, 2.f); // Flip horizontally
+    }
+
+public:
+    // Character sheet for an enemy type, standing or dying.
+    static const char* sheet(int type, bool dying) {
+        static const char* sheets[EncounterTable::ENEMY_TYPES][2] = {
+            { "Cronies Standing.png", "Cronies Dying.png" },
+            { "Captain Standing.png", "Captain Dying.png" },
+            { "Boss Standing.png", "Boss Dying.png" }
+        };
+        return sheets[type][dying ? 1 : 0];
+    }
+
+    Enemy() : HP(10), alive(true), enemyType(0), animator(-1) {
+    }
+
+    Enemy(const Enemy&) = delete;
+    Enemy& operator=(const Enemy&) = delete;
+
+    int getHP() const { return HP; }
+    void setHP(int val) { HP = val; }
+    bool isAlive() const { return alive; }
+    void setAlive(bool status) { alive = status; }
+    int getEnemyType() const { return enemyType; }
+    virtual void takeDMG(int val) {
+        HP -= val;
+        if (HP <= 0) {
+            alive = false;
+            Animation::play(animator, Animation::DYING);
+        }
+    }
+    // Damage before status modifiers; the battle applies it to the player.
+    int rollDamage() const { return BattleState::rollAttack(enemyType, Random::local()); }
+    // Sets HP and life directly, without hit animations (undo).
+    void restore(int hp, bool isAlive) {
+        if (isAlive && !alive) Animation::revive(animator);
+        HP = hp;
+        alive = isAlive;
+    }
+    void playAttack() { Animation::play(animator, Animation::ATTACK); }
+    Sprite& getSprite() { return sprite; }
+
+    virtual ~Enemy() {
+        Animation::destroy(animator);
+    }
+};
+
+class Cronie : public Enemy {
+public:
+    Cronie() {
+        enemyType = 0;
+        setHP(BattleState::enemyMaxHP(enemyType));
+        LOG_DEBUG(Log::Combat, "Cronie deployed");
+        setupAnimation();
+    }
+};
+
+class Captain : public Enemy {
+public:
+    Captain() {
+        enemyType = 1;
+        setHP(BattleState::enemyMaxHP(enemyType));
+        LOG_DEBUG(Log::Combat, "Captain deployed");
+        setupAnimation();
+    }
+};
+
+class Boss : public Enemy {
+public:
+    Boss() {
+        enemyType = 2;
+        setHP(BattleState::enemyMaxHP(enemyType));
+        LOG_DEBUG(Log::Combat, "Boss deployed");
+        setupAnimation();
+    }
+
+    void heal() {
+        if (Random::local().below(6) > 2) {
+            setHP(getHP() + 2);
+            Animation::play(animator, Animation::HEAL);
+        }
+    }
+};
+
+// Card definitions loaded from cards.txt, each compiled to a short run of
+// instructions in one shared array. Playing a card is a loop over that run.
+class CardLibrary : private RuleFile {
+public:
+    enum Target { TARGET_ENEMY, TARGET_SELF, TARGET_ALL };
+
+    enum OpCode {
+        OP_END,
+        OP_ONCE,        // Stop if this card was already played this battle
+        OP_DAMAGE,      // Chosen enemy, or the first one standing
+        OP_DAMAGE_ALL,
+        OP_HEAL,
+        OP_STATUS_SELF,
+        OP_STATUS_TARGET,
+        OP_STATUS_ALL
+    };
+
+    struct Instruction {
+        unsigned char op;
+        unsigned char card;   // Definition id, for OP_ONCE
+        unsigned char status; // BattleState::Status, for the status ops
+        unsigned char turns;
+        short value;
+        short step;           // Added per upgrade level
+    };
+
+    struct Definition {
+        string name;
+        string art;
+        int cost;
+        Target target;
+        int starter;
+        int price;
+        int unlockCopies;
+        int limit;
+        bool upgradable;
+        int codeStart;
+    };
+
+    // Most a card can do in one play, ignoring targets and mana. The turn
+    // solver sums these to bound what the rest of a hand could still achieve.
+    struct Potential {
+        int damage;      // Per hit, before Power
+        int hits;        // Single-target hits
+        int areaHits;    // Hits on every enemy
+        int heal;
+        int power;
+        int exhaust;     // Per enemy affected
+        int exhaustAll;
+    };
+
+    static const int MAX_DEFINITIONS = 32; // Bits in BattleState::usedOnce
+
+private:
+    vector<Definition> definitions;
+    vector<Instruction> code;
+    Definition card; // Block being read
+    vector<Instruction> program;
+
+    bool beginBlock(istringstream& words, const char* source, int lineNumber) override {
+        card = Definition();
+        card.cost = 1;
+        card.target = TARGET_ENEMY;
+        card.starter = card.price = card.unlockCopies = card.limit = 0;
+        card.upgradable = false;
+        program.clear();
+        bool ok = (bool)(words >> card.name);
+        if (!ok) LOG_WARN(Log::Cards, "%s:%d: card without a name", source, lineNumber);
+        return ok;
+    }
+
+    bool readLine(const string& key, istringstream& words) override {
+        bool ok = true;
+        if (key == "art") ok = (bool)(words >> card.art);
+        else if (key == "cost") ok = (bool)(words >> card.cost);
+        else if (key == "starter") ok = (bool)(words >> card.starter);
+        else if (key == "price") ok = (bool)(words >> card.price);
+        else if (key == "unlock") ok = (bool)(words >> card.unlockCopies);
+        else if (key == "limit") ok = (bool)(words >> card.limit);
+        else if (key == "target") {
+            string target;
+            words >> target;
+            if (target == "enemy") card.target = TARGET_ENEMY;
+            else if (target == "self") card.target = TARGET_SELF;
+            else if (target == "all") card.target = TARGET_ALL;
+            else ok = false;
+        }
+        else if (key == "once") {
+            Instruction once = { OP_ONCE, 0, 0, 0, 0, 0 };
+            program.push_back(once);
+        }
+        else if (key == "damage" || key == "damage_all" || key == "heal" ||
+            key == "power" || key == "exhaust" || key == "exhaust_all") {
+            Instruction effect = { OP_DAMAGE, 0, 0, 0, 0, 0 };
+            if (key == "damage_all") effect.op = OP_DAMAGE_ALL;
+            else if (key == "heal") effect.op = OP_HEAL;
+            else if (key == "power") effect.op = OP_STATUS_SELF;
+            else if (key == "exhaust") effect.op = OP_STATUS_TARGET;
+            else if (key == "exhaust_all") effect.op = OP_STATUS_ALL;
+            effect.status = key == "power" ? BattleState::POWER : BattleState::EXHAUST;
+
+            int value = 0;
+            string step;
+            ok = (bool)(words >> value);
+            if (ok && effect.op >= OP_STATUS_SELF) {
+                int turns = 0;
+                ok = (bool)(words >> turns) && turns > 0 && turns < 256;
+                effect.turns = (unsigned char)turns;
+            }
+            if (ok && words >> step) {
+                ok = step.size() > 1 && step[0] == '+' && isdigit((unsigned char)step[1]);
+                if (ok) effect.step = (short)atoi(step.c_str() + 1);
+            }
+            effect.value = (short)value;
+            if (ok) program.push_back(effect);
+        }
+        else ok = false;
+        return ok;
+    }
+
+    void endBlock(const char* source) override {
+        if ((int)definitions.size() >= MAX_DEFINITIONS) {
+            LOG_WARN(Log::Cards, "%s: more than %d cards, dropping %s", source, MAX_DEFINITIONS, card.name.c_str());
+            return;
+        }
+        card.codeStart = code.size();
+        for (Instruction& instruction : program) {
+            instruction.card = (unsigned char)definitions.size();
+            if (instruction.step != 0) card.upgradable = true;
+            code.push_back(instruction);
+        }
+        Instruction end = { OP_END, 0, 0, 0, 0, 0 };
+        code.push_back(end);
+        definitions.push_back(card);
+    }
+
+    const string& blockName() const override { return card.name; }
+
+    CardLibrary() : RuleFile("card", Log::Cards) {}
+
+public:
+    static CardLibrary& instance() {
+        static CardLibrary library;
+        return library;
+    }
+
+    // Reads the definitions file. There is no built-in set: false, with the
+    // library left empty, if the file is missing or defines no cards.
+    bool load(const string& file) {
+        definitions.clear();
+        code.clear();
+        if (!parseFile(file)) return false;
+        if (definitions.empty()) {
+            LOG_ERROR(Log::Cards, "No cards in %s", file.c_str());
+            code.clear();
+            return false;
+        }
+        LOG_INFO(Log::Cards, "Loaded %d cards (%d instructions)", (int)definitions.size(), (int)code.size());
+        return true;
+    }
+
+    int count() const { return definitions.size(); }
+    const Definition& get(int id) const { return definitions[id]; }
+
+    Potential potential(int id, int level) const {
+        Potential result = Potential();
+        for (const Instruction* pc = &code[definitions[id].codeStart]; pc->op != OP_END; pc++) {
+            int amount = pc->value + pc->step * level;
+            switch (pc->op) {
+            case OP_DAMAGE: result.damage = max(result.damage, amount); result.hits++; break;
+            case OP_DAMAGE_ALL: result.damage = max(result.damage, amount); result.areaHits++; break;
+            case OP_HEAL: result.heal += amount; break;
+            case OP_STATUS_SELF: if (pc->status == BattleState::POWER) result.power += amount; break;
+            case OP_STATUS_TARGET: if (pc->status == BattleState::EXHAUST) result.exhaust += amount; break;
+            case OP_STATUS_ALL: if (pc->status == BattleState::EXHAUST) result.exhaustAll += amount; break;
+            }
+        }
+        return result;
+    }
+
+    // Runs a card against the state. Returns false if the card had no effect
+    // because its once-per-battle use is spent.
+    bool play(int id, int level, BattleState& state, int target) const {
+        if (target < 0 || target >= state.enemyCount || !state.enemyAlive[target]) {
+            target = state.firstAliveEnemy();
+        }
+        int power = state.statusOf(BattleState::POWER, BattleState::PLAYER);
+
+        for (const Instruction* pc = &code[definitions[id].codeStart]; ; pc++) {
+            int amount = pc->value + pc->step * level;
+            switch (pc->op) {
+            case OP_END:
+                return true;
+            case OP_ONCE:
+                if (state.usedOnce & (1u << pc->card)) return false;
+                state.usedOnce |= 1u << pc->card;
+                break;
+            case OP_DAMAGE:
+                state.damageEnemy(target, amount + power);
+                break;
+            case OP_DAMAGE_ALL:
+                for (int i = 0; i < state.enemyCount; i++) {
+                    state.damageEnemy(i, amount + power);
+                }
+                break;
+            case OP_HEAL:
+                state.healPlayer(amount);
+                break;
+            case OP_STATUS_SELF:
+                state.applyStatus(pc->status, BattleState::PLAYER, amount, pc->turns);
+                break;
+            case OP_STATUS_TARGET:
+                if (target >= 0) state.applyStatus(pc->status, 1 + target, amount, pc->turns);
+                break;
+            case OP_STATUS_ALL:
+                for (int i = 0; i < state.enemyCount; i++) {
+                    if (state.enemyAlive[i]) state.applyStatus(pc->status, 1 + i, amount, pc->turns);
+                }
+                break;
+            }
+        }
+    }
+};
+
+// The rule files every mode needs, from the working directory. They have no
+// built-in copy, so a missing or empty file stops the caller.
+static bool loadRuleFiles() {
+    return CardLibrary::instance().load("cards.txt") && EncounterTable::instance().load("encounters.txt");
+}
+
+// Card ids, with upgrade levels and owned copies tracked per definition so a
+// new run starts from the card file again.
+class Deck {
+private:
+    static const int MAX_CARDS = 25;
+    vector<int> cards;  // Changed from array to vector for easier management
+    vector<int> levels;
+    vector<int> copies;
+
+public:
+    // The starter cards, shuffled with the caller's generator.
+    explicit Deck(Random& random) {
+        const CardLibrary& library = CardLibrary::instance();
+        levels.assign(library.count(), 0);
+        copies.assign(library.count(), 0);
+
+        // Initialize with basic cards
+        for (int id = 0; id < library.count(); id++) {
+            for (int i = 0; i < library.get(id).starter; i++) {
+                addCard(id);
+            }
+        }
+        shuffle(random);
+    }
+
+    bool addCard(int id) {
+        if (cards.size() >= MAX_CARDS) return false;
+
+        int limit = CardLibrary::instance().get(id).limit;
+        if (limit > 0 && copies[id] >= limit) return false;
+
+        copies[id]++;
+        cards.push_back(id);
+        return true;
+    }
+
+    void shuffle(Random& random) {
+        random.shuffle(cards);
+    }
+
+    // -1 when the deck is empty
+    int draw() {
+        if (cards.empty()) return -1;
+
+        int card = cards.back();
+        cards.pop_back();
+        return card;
+    }
+
+    bool discard(int card) {
+        if (cards.size() >= MAX_CARDS) return false;
+        cards.insert(cards.begin(), card); // Add to bottom of deck
+        return true;
+    }
+
+    // Takes back the card just discarded (undoing a play).
+    bool retract(int card) {
+        if (cards.empty() || cards.front() != card) return false;
+        cards.erase(cards.begin());
+        return true;
+    }
+
+    void returnToDeck(int card) {
+        if (cards.size() < MAX_CARDS) {
+            cards.push_back(card); // Add to top of deck
+        }
+    }
+
+    bool owns(int id) const { return copies[id] > 0; }
+    int getLevel(int id) const { return levels[id]; }
+    void upgrade(int id) { levels[id]++; }
+
+    // Shop price: unlocking at the listed price, then 25 more per upgrade
+    int getPrice(int id) const {
+        return CardLibrary::instance().get(id).price + 25 * levels[id];
+    }
+
+    int getCardCount() const { return cards.size(); }
+    int getCard(int index) const { return cards[index]; } // 0 is the bottom of the deck
+    int getMaxCards() const { return MAX_CARDS; }
+};
+
+// Best sequence of plays for the rest of the player's turn: every order of the
+// cards in hand and every target, scored by how the position looks going into
+// the enemy turn. Positions reached by different orders share a memo entry,
+// and branches whose optimistic bound can't beat the best line are cut.
+// One solver per caller; nothing is allocated while solving.
+class TurnSolver {
+public:
+    enum Mode {
+        EXACT,  // Full search
+        GREEDY  // Best single play at each step
+    };
+
+    static const int HAND_SIZE = 4;
+
+    struct Line {
+        int plays;
+        int slot[HAND_SIZE];   // Hand index
+        int target[HAND_SIZE]; // Enemy index, -1 when untargeted
+        float score;
+        bool lethal;
+    };
+
+private:
+    static const int MEMO_SIZE = 4096; // Power of two
+
+    // Score weights, per point of each quantity
+    static constexpr float WIN = 10000.f;
+    static constexpr float HP_WEIGHT = 20.f;
+    static constexpr float ENEMY_HP_WEIGHT = 10.f;
+    static constexpr float ENEMY_WEIGHT = 15.f;
+    static constexpr float POWER_WEIGHT = 5.f;
+    static constexpr float DEATH = 500.f; // Worst-case enemy turn kills the player
+
+    struct Continuation {
+        signed char plays;
+        signed char slot[HAND_SIZE];
+        signed char target[HAND_SIZE];
+    };
+
+    struct MemoEntry {
+        Uint64 key;
+        unsigned generation;
+        float value;
+        bool exact; // Otherwise value is an upper bound
+        Continuation line;
+    };
+
+    vector<MemoEntry> memo;
+    unsigned generation;
+
+    // Per solve
+    const CardLibrary* library;
+    int hand[HAND_SIZE];
+    int levels[HAND_SIZE];
+    CardLibrary::Potential potentials[HAND_SIZE];
+    Line best;
+    float bestScore; // Best complete line seen so far; branches that can't beat it are cut
+    int nodes;
+    float lastMicros;
+
+    static Uint64 mix(Uint64 hash, int value) {
+        hash ^= (Uint64)(unsigned)value;
+        return hash * 1099511628211ULL;
+    }
+
+    static Uint64 hashState(const BattleState& state, int usedMask, int mana) {
+        Uint64 hash = 14695981039346656037ULL;
+        hash = mix(hash, usedMask);
+        hash = mix(hash, mana);
+        hash = mix(hash, state.playerHP);
+        hash = mix(hash, (int)state.usedOnce);
+        for (int i = 0; i < state.enemyCount; i++) {
+            hash = mix(hash, state.enemyAlive[i] ? state.enemyHP[i] : -1000);
+        }
+        for (int s = 0; s < BattleState::STATUS_COUNT; s++) {
+            hash = mix(hash, (int)state.statusActive[s]);
+            for (unsigned bits = state.statusActive[s]; bits; bits &= bits - 1) {
+                int entity = BattleState::lowestBit(bits);
+                hash = mix(hash, state.statusValue[s][entity]);
+                hash = mix(hash, state.statusTurns[s][entity]);
+            }
+        }
+        return hash;
+    }
+
+    // Ending the turn here: HP kept, expected enemy damage, enemy HP and count
+    // left, Power that carries into the next turn.
+    static float evaluate(const BattleState& state, float& deathPenalty) {
+        deathPenalty = 0.f;
+        if (state.firstAliveEnemy() < 0) return WIN + state.playerHP * HP_WEIGHT;
+
+        float incoming = 0.f;
+        int worstCase = 0;
+        float score = state.playerHP * HP_WEIGHT;
+        for (int i = 0; i < state.enemyCount; i++) {
+            if (!state.enemyAlive[i]) continue;
+            incoming += state.expectedEnemyDamage(i);
+            worstCase += state.enemyDamage(i, BattleState::attackMax(state.enemyType[i]));
+            score -= state.enemyHP[i] * ENEMY_HP_WEIGHT + ENEMY_WEIGHT;
+        }
+        score -= incoming * HP_WEIGHT;
+        if (state.statusTurns[BattleState::POWER][BattleState::PLAYER] > 1) {
+            score += state.statusOf(BattleState::POWER, BattleState::PLAYER) * POWER_WEIGHT;
+        }
+        if (worstCase >= state.playerHP) {
+            deathPenalty = DEATH;
+            score -= DEATH;
+        }
+        return score;
+    }
+
+    // Optimistic score if every affordable card left in hand landed at its best.
+    float upperBound(const BattleState& state, int usedMask, int mana, float score, float deathPenalty) const {
+        int alive = 0, enemyHP = 0;
+        float incoming = 0.f;
+        for (int i = 0; i < state.enemyCount; i++) {
+            if (state.enemyAlive[i]) {
+                alive++;
+                enemyHP += state.enemyHP[i];
+                incoming += state.expectedEnemyDamage(i);
+            }
+        }
+
+        int power = state.statusOf(BattleState::POWER, BattleState::PLAYER);
+        for (int i = 0; i < HAND_SIZE; i++) {
+            if (hand[i] >= 0 && !(usedMask & (1 << i)) && library->get(hand[i]).cost <= mana) power += potentials[i].power;
+        }
+
+        int damage = 0, heal = 0, exhaust = 0, powerGain = 0;
+        for (int i = 0; i < HAND_SIZE; i++) {
+            if (hand[i] < 0 || (usedMask & (1 << i)) || library->get(hand[i]).cost > mana) continue;
+            const CardLibrary::Potential& card = potentials[i];
+            damage += (card.damage + power) * (card.hits + card.areaHits * alive);
+            heal += card.heal;
+            exhaust += card.exhaust + card.exhaustAll * alive;
+            powerGain += card.power;
+        }
+
+        int missing = state.playerMaxHP - state.playerHP;
+        float healGain = min(heal, missing) * HP_WEIGHT;
+        if (alive == 0) return score + healGain;
+
+        // Kills also take away incoming damage, and exhaust can't cut more than is coming.
+        float blocked = min(incoming, (float)exhaust + (damage > 0 ? incoming : 0.f));
+        float bound = score + min(damage, enemyHP) * ENEMY_HP_WEIGHT + alive * ENEMY_WEIGHT +
+            healGain + blocked * HP_WEIGHT + powerGain * POWER_WEIGHT + deathPenalty;
+        if (damage >= enemyHP) {
+            bound = max(bound, WIN + min(state.playerMaxHP, state.playerHP + heal) * HP_WEIGHT);
+        }
+        return bound;
+    }
+
+    // Value of the best line from here, with that line in `line`. `exact` is
+    // cleared when a branch was cut, making the value only an upper bound.
+    float search(const BattleState& state, int usedMask, int mana, Continuation& line, bool& exact) {
+        nodes++;
+        line.plays = 0;
+        exact = true;
+
+        Uint64 key = hashState(state, usedMask, mana);
+        MemoEntry& entry = memo[key & (MEMO_SIZE - 1)];
+        if (entry.generation == generation && entry.key == key) {
+            if (entry.exact) {
+                line = entry.line;
+                bestScore = max(bestScore, entry.value);
+                return entry.value;
+            }
+            if (entry.value <= bestScore) {
+                exact = false;
+                return entry.value;
+            }
+        }
+
+        float deathPenalty;
+        float value = evaluate(state, deathPenalty);
+        float cutBound = value;
+        bestScore = max(bestScore, value);
+
+        for (int i = 0; i < HAND_SIZE; i++) {
+            if (hand[i] < 0 || (usedMask & (1 << i))) continue;
+            const CardLibrary::Definition& card = library->get(hand[i]);
+            if (card.cost > mana) continue;
+
+            int firstTarget = -1, lastTarget = -1;
+            if (card.target == CardLibrary::TARGET_ENEMY) {
+                firstTarget = 0;
+                lastTarget = state.enemyCount - 1;
+            }
+            for (int target = firstTarget; target <= lastTarget; target++) {
+                if (target >= 0 && !state.enemyAlive[target]) continue;
+
+                BattleState next = state;
+                if (!library->play(hand[i], levels[i], next, target)) continue;
+
+                float nextDeath;
+                float nextScore = evaluate(next, nextDeath);
+                float bound = upperBound(next, usedMask | (1 << i), mana - card.cost, nextScore, nextDeath);
+                if (bound <= bestScore) {
+                    cutBound = max(cutBound, bound);
+                    exact = false;
+                    continue;
+                }
+
+                Continuation rest;
+                bool restExact;
+                float child = search(next, usedMask | (1 << i), mana - card.cost, rest, restExact);
+                if (!restExact) {
+                    cutBound = max(cutBound, child);
+                    exact = false;
+                }
+                if (child > value) {
+                    value = child;
+                    line.plays = 1;
+                    line.slot[0] = (signed char)i;
+                    line.target[0] = (signed char)target;
+                    for (int step = 0; step < rest.plays; step++) {
+                        line.slot[line.plays] = rest.slot[step];
+                        line.target[line.plays] = rest.target[step];
+                        line.plays++;
+                    }
+                }
+            }
+        }
+
+        entry.key = key;
+        entry.generation = generation;
+        entry.exact = exact;
+        entry.value = exact ? value : max(value, cutBound);
+        entry.line = line;
+        return value;
+    }
+
+    void greedy(BattleState state, int mana) {
+        int usedMask = 0;
+        while (true) {
+            int bestSlot = -1, bestTarget = -1;
+            float deathPenalty;
+            float bestScore = evaluate(state, deathPenalty);
+            BattleState bestState;
+            for (int i = 0; i < HAND_SIZE; i++) {
+                if (hand[i] < 0 || (usedMask & (1 << i)) || library->get(hand[i]).cost > mana) continue;
+                bool targeted = library->get(hand[i]).target == CardLibrary::TARGET_ENEMY;
+                for (int target = targeted ? 0 : -1; target < (targeted ? state.enemyCount : 0); target++) {
+                    if (target >= 0 && !state.enemyAlive[target]) continue;
+                    BattleState next = state;
+                    nodes++;
+                    if (!library->play(hand[i], levels[i], next, target)) continue;
+                    float score = evaluate(next, deathPenalty);
+                    if (score > bestScore) {
+                        bestScore = score;
+                        bestSlot = i;
+                        bestTarget = target;
+                        bestState = next;
+                    }
+                }
+            }
+            if (bestSlot < 0) break;
+
+            best.slot[best.plays] = bestSlot;
+            best.target[best.plays] = bestTarget;
+            best.plays++;
+            best.score = bestScore;
+            usedMask |= 1 << bestSlot;
+            mana -= library->get(hand[bestSlot]).cost;
+            state = bestState;
+        }
+    }
+
+public:
+    TurnSolver() : memo(MEMO_SIZE), generation(0), library(nullptr), bestScore(0.f), nodes(0), lastMicros(0.f) {
+        for (MemoEntry& entry : memo) entry.generation = 0;
+    }
+
+    // hand holds card ids (-1 for empty slots); levels come from the deck.
+    Line solve(const BattleState& state, const int cards[HAND_SIZE], const Deck& deck, int mana, Mode mode = EXACT) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        library = &CardLibrary::instance();
+        for (int i = 0; i < HAND_SIZE; i++) {
+            hand[i] = cards[i];
+            levels[i] = cards[i] >= 0 ? deck.getLevel(cards[i]) : 0;
+            potentials[i] = cards[i] >= 0 ? library->potential(cards[i], levels[i]) : CardLibrary::Potential();
+        }
+        if (++generation == 0) generation = 1; // 0 marks never-used entries
+
+        nodes = 0;
+        best = Line();
+        float deathPenalty;
+        best.score = evaluate(state, deathPenalty);
+
+        if (mode == GREEDY) {
+            greedy(state, mana);
+        }
+        else {
+            Continuation line;
+            bool exact;
+            bestScore = best.score;
+            best.score = search(state, 0, mana, line, exact);
+            best.plays = line.plays;
+            for (int i = 0; i < line.plays; i++) {
+                best.slot[i] = line.slot[i];
+                best.target[i] = line.target[i];
+            }
+        }
+
+        best.lethal = best.score >= WIN;
+        lastMicros = chrono::duration<float, micro>(chrono::steady_clock::now() - start).count();
+        return best;
+    }
+
+    int getNodes() const { return nodes; }
+    float getLastMicros() const { return lastMicros; }
+};
+
+class Battle : public Scene {
+public:
+    enum Outcome { LOST, WON };
+
+private:
+    Player& player;
+    Deck& deck;
+    int node;
+    int prepareStep;
+
+    Enemy* enemies[4];
+    int enemyCount;
+    BattleState state; // Combat numbers the cards run against
+    int hand[4]; // Card ids, -1 for an empty slot
+    Sprite handSprites[4];
+    int cardsInHand;
+    bool playerTurn;
+    bool battleOver;
+    bool playerWon;
+    int selectedCard;
+    int selectedEnemy;
+    Text actionText;
+    Text turnText;
+    Text statusTexts[BattleState::ENTITIES]; // Active effects under the player and each enemy
+
+    Sprite background;
+    Font font;
+
+    StaticLayer backgroundLayer; // Background and HUD boxes
+    StaticLayer handLayer; // Cards in hand and the action prompt
+
+    RectangleShape hpBox;
+    RectangleShape manaBox;
+    Sprite previewSprite; // Enlarged copy of the card being aimed
+
+    // Suggested line for the rest of the turn, toggled with H
+    TurnSolver solver;
+    TurnSolver::Line hint;
+    bool showHint;
+    RectangleShape hintFrames[TurnSolver::HAND_SIZE];
+    Text hintCardLabels[TurnSolver::HAND_SIZE];
+    Text hintTargetLabels[TurnSolver::HAND_SIZE];
+
+    // Logic positions of a character for the last two ticks; rendering blends them.
+    struct Motion {
+        Vector2f home;
+        Vector2f previous;
+        Vector2f current;
+        float lungeTime; // Seconds left in an attack lunge
+        float direction; // +1 lunges right, -1 left
+    };
+    Motion playerMotion;
+    Motion enemyMotion[4];
+    ParticleSystem particles;
+
+    int nextAttacker;
+    float enemyTurnTimer;
+
+    // Undo/redo of card plays within the player's turn. A snapshot is the whole
+    // position as plain values (no sprites or textures, a few hundred bytes), so
+    // taking or restoring one is a single copy. History is dropped whenever
+    // hidden information arrives: a new hand is drawn or enemy attacks roll.
+    struct Snapshot {
+        BattleState state;
+        int hand[4];
+        int cardsInHand;
+        int mana;
+        int discarded; // Undo: card the next play discarded. Redo: card this play discarded. -1 if none
+    };
+    static const int HISTORY_SIZE = 16;
+    Snapshot undoHistory[HISTORY_SIZE]; // Ring; the oldest play drops off
+    Snapshot redoHistory[HISTORY_SIZE];
+    int undoStart;
+    int undoCount;
+    int redoCount;
+
+    const float PLAYER_SCALE = 2.0f;
+    const float ENEMY_SCALE = 2.0f;
+    const float CARD_SCALE = 0.1f;
+    const float PREVIEW_SCALE = 0.2f;
+    const float LUNGE_DURATION = 0.25f;
+    const float LUNGE_DISTANCE = 40.f;
+    const float ENEMY_ATTACK_DELAY = 0.3f;
+
+    enum InputState {
+        SELECT_CARD,
+        SELECT_ENEMY,
+        PROCESSING
+    };
+    InputState currentState;
+
+    // Card display members
+    const Vector2f CARD_POSITIONS[4] = {
+        Vector2f(250, 575),
+        Vector2f(400, 575),
+        Vector2f(550, 575),
+        Vector2f(700, 575)
+    };
+
+    void setupEnemies() {
+        DailyChallenge& daily = DailyChallenge::instance();
+        if (daily.isActive()) {
+            Random encounters = DailyChallenge::encounters(daily.getSeed(), node);
+            state.spawnEnemies(node, encounters);
+        }
+        else {
+            state.spawnEnemies(node, Random::local());
+        }
+        enemyCount = state.enemyCount;
+        for (int i = 0; i < enemyCount; i++) {
+            switch (state.enemyType[i]) {
+            case 0: enemies[i] = new Cronie(); break;
+            case 1: enemies[i] = new Captain(); break;
+            default: enemies[i] = new Boss(); break;
+            }
+        }
+
+        float startY = 150;
+        float spacing = (600 - startY) / (enemyCount + 1);
+        for (int i = 0; i < enemyCount; i++) {
+            float x = 800;
+            float y = startY + spacing * (i + 1);
+            placeMotion(enemyMotion[i], Vector2f(x, y), -1.f);
+            enemies[i]->getSprite().setPosition(x, y);
+            enemies[i]->getSprite().setScale(-ENEMY_SCALE, ENEMY_SCALE);
+        }
+    }
+
+    void placeMotion(Motion& motion, Vector2f home, float direction) {
+        motion.home = home;
+        motion.previous = home;
+        motion.current = home;
+        motion.lungeTime = 0.f;
+        motion.direction = direction;
+    }
+
+    void stepMotion(Motion& motion, float dt) {
+        motion.previous = motion.current;
+        motion.current = motion.home;
+        if (motion.lungeTime > 0.f) {
+            motion.lungeTime = max(0.f, motion.lungeTime - dt);
+            float progress = 1.f - motion.lungeTime / LUNGE_DURATION;
+            motion.current.x += motion.direction * LUNGE_DISTANCE * sin(progress * 3.14159265f);
+        }
+    }
+
+    void placePlayer() {
+        placeMotion(playerMotion, Vector2f(200, 360), 1.f);
+        player.getSprite().setPosition(200, 360);
+        player.getSprite().setScale(PLAYER_SCALE, PLAYER_SCALE);
+    }
+
+    void setupUI() {
+        hpBox.setSize(Vector2f(200, 30));
+        hpBox.setPosition(900, 650);
+        hpBox.setFillColor(Color(200, 50, 50, 200));
+
+        manaBox.setSize(Vector2f(200, 30));
+        manaBox.setPosition(1150, 650);
+        manaBox.setFillColor(Color(50, 50, 200, 200));
+
+        actionText.setFont(font);
+        actionText.setCharacterSize(24);
+        actionText.setPosition(50, 600);
+        actionText.setFillColor(Color::White);
+
+        turnText.setFont(font);
+        turnText.setCharacterSize(36);
+        turnText.setFillColor(Color::White);
+
+        for (int step = 0; step < TurnSolver::HAND_SIZE; step++) {
+            hintCardLabels[step].setFont(font);
+            hintCardLabels[step].setCharacterSize(28);
+            hintCardLabels[step].setFillColor(Color(255, 215, 0));
+            hintTargetLabels[step] = hintCardLabels[step];
+        }
+
+        for (int entity = 0; entity < BattleState::ENTITIES; entity++) {
+            statusTexts[entity].setFont(font);
+            statusTexts[entity].setCharacterSize(18);
+            statusTexts[entity].setFillColor(entity == BattleState::PLAYER ? Color(255, 200, 80) : Color(150, 200, 255));
+        }
+    }
+
+    void fillHand() {
+        // Clear current hand first
+        for (int i = 0; i < 4; i++) {
+            if (hand[i] >= 0) {
+                deck.discard(hand[i]);
+                hand[i] = -1;
+            }
+        }
+
+        // Draw new cards
+        cardsInHand = 0;
+        for (int i = 0; i < 4; i++) {
+            hand[i] = deck.draw();
+            if (hand[i] >= 0) {
+                cardsInHand++;
+                float scale = CARD_SCALE / CardArt::scaleOf(CardArt::THUMBNAIL);
+                handSprites[i].setTexture(CardArt::get(CardLibrary::instance().get(hand[i]).art, CardArt::THUMBNAIL), true);
+                handSprites[i].setScale(scale, scale);
+            }
+        }
+        updateActionText();
+    }
+
+    void cleanup() {
+        for (int i = 0; i < enemyCount; i++) {
+            delete enemies[i];
+            enemies[i] = nullptr;
+        }
+        for (int i = 0; i < 4; i++) {
+            if (hand[i] >= 0) {
+                deck.discard(hand[i]);
+                hand[i] = -1;
+            }
+        }
+        cardsInHand = 0;
+    }
+
+    void awardCoins() {
+        for (int i = 0; i < enemyCount; i++) {
+            if (enemies[i]) player.increaseCoins(BattleState::coinReward(enemies[i]->getEnemyType()));
+        }
+        player.increaseCoins(BattleState::VICTORY_COINS);
+    }
+
+    void updateActionText() {
+        ALLOC_ZONE("Battle::updateActionText");
+        string text;
+        if (currentState == SELECT_CARD) {
+            text = "Select a card:\n";
+            for (int i = 0; i < 4; i++) {
+                if (hand[i] >= 0) {
+                    const CardLibrary::Definition& card = CardLibrary::instance().get(hand[i]);
+                    text += to_string(i + 1) + ") " + card.name + " (Cost: " + to_string(card.cost) + ")\n";
+                }
+            }
+            text += "Press ENTER to end turn, H for a hint, Z/Y to undo/redo";
+        }
+        else if (currentState == SELECT_ENEMY) {
+            text = "Select target:\n";
+            int aliveCount = 0;
+            for (int i = 0; i < enemyCount; i++) {
+                if (enemies[i] && enemies[i]->isAlive()) {
+                    aliveCount++;
+                    text += to_string(aliveCount) + ") ";
+                    switch (enemies[i]->getEnemyType()) {
+                    case 0: text += "Cronie"; break;
+                    case 1: text += "Captain"; break;
+                    case 2: text += "Boss"; break;
+                    }
+                    text += "\n";
+                }
+            }
+            text += "Press ESC to cancel";
+        }
+        else {
+            text = "Processing...";
+        }
+        actionText.setString(text);
+        handLayer.invalidate();
+        updateHint();
+    }
+
+    void updateHint() {
+        ALLOC_ZONE("Battle::updateHint");
+        hint.plays = 0;
+        if (!showHint || currentState != SELECT_CARD) return;
+
+        syncState();
+        hint = solver.solve(state, hand, deck, player.getCurrentMana());
+        LOG_DEBUG(Log::Combat, "Hint: %d plays%s, %d positions in %.0f us", hint.plays,
+            hint.lethal ? " (lethal)" : "", solver.getNodes(), solver.getLastMicros());
+
+        for (int step = 0; step < hint.plays; step++) {
+            int slot = hint.slot[step];
+            FloatRect bounds = handSprites[slot].getGlobalBounds();
+            hintFrames[step].setPosition(CARD_POSITIONS[slot].x - 4, CARD_POSITIONS[slot].y - 4);
+            hintFrames[step].setSize(Vector2f(bounds.width + 8, bounds.height + 8));
+            hintFrames[step].setFillColor(hint.lethal ? Color(255, 80, 60, 180) : Color(255, 215, 0, 160));
+
+            hintCardLabels[step].setString(to_string(step + 1));
+            hintCardLabels[step].setPosition(CARD_POSITIONS[slot].x + bounds.width / 2, CARD_POSITIONS[slot].y - 32);
+            hintTargetLabels[step].setString(to_string(step + 1));
+            if (hint.target[step] >= 0) {
+                Vector2f home = enemyMotion[hint.target[step]].home;
+                hintTargetLabels[step].setPosition(home.x - 60, home.y - 40);
+            }
+        }
+    }
+
+    void updateStatusText() {
+        ALLOC_ZONE("Battle::updateStatusText");
+        for (int entity = 0; entity < BattleState::ENTITIES; entity++) {
+            string text;
+            int power = state.statusOf(BattleState::POWER, entity);
+            int exhaust = state.statusOf(BattleState::EXHAUST, entity);
+            if (power) text += "Power +" + to_string(power) + " (" + to_string(state.statusTurns[BattleState::POWER][entity]) + ")\n";
+            if (exhaust) text += "Exhaust -" + to_string(exhaust) + " (" + to_string(state.statusTurns[BattleState::EXHAUST][entity]) + ")\n";
+            statusTexts[entity].setString(text);
+        }
+    }
+
+    void updateTurnText() {
+        ALLOC_ZONE("Battle::updateTurnText");
+        turnText.setString(playerTurn ? "Player Turn" : "Enemy Turn");
+        turnText.setPosition(640, 20); // Centred by the renderer
+    }
+
+    void handleCardSelection(int cardNum) {
+        if (cardNum < 1 || cardNum > 4 || hand[cardNum - 1] < 0 ||
+            player.getCurrentMana() < CardLibrary::instance().get(hand[cardNum - 1]).cost) {
+            return;
+        }
+
+        selectedCard = cardNum - 1;
+        if (CardLibrary::instance().get(hand[selectedCard]).target != CardLibrary::TARGET_ENEMY) {
+            playSelectedCard(-1); // No target to pick
+        }
+        else {
+            currentState = SELECT_ENEMY;
+        }
+        updateActionText();
+    }
+
+    void handleEnemySelection(int enemyNum) {
+        if (enemyNum < 1) return;
+
+        int aliveCount = 0;
+        for (int i = 0; i < enemyCount; i++) {
+            if (enemies[i] && enemies[i]->isAlive()) {
+                aliveCount++;
+                if (aliveCount == enemyNum) {
+                    playSelectedCard(i);
+                    return;
+                }
+            }
+        }
+    }
+
+    Snapshot capture(int discarded) {
+        syncState();
+        Snapshot snapshot;
+        snapshot.state = state;
+        for (int i = 0; i < 4; i++) snapshot.hand[i] = hand[i];
+        snapshot.cardsInHand = cardsInHand;
+        snapshot.mana = player.getCurrentMana();
+        snapshot.discarded = discarded;
+        return snapshot;
+    }
+
+    // Puts the objects back to a snapshot without replaying hits or heals.
+    void restore(const Snapshot& snapshot) {
+        state = snapshot.state;
+        for (int i = 0; i < 4; i++) hand[i] = snapshot.hand[i];
+        cardsInHand = snapshot.cardsInHand;
+        player.setCurrentMana(snapshot.mana);
+        player.setHP(state.playerHP);
+        for (int i = 0; i < enemyCount; i++) {
+            enemies[i]->restore(state.enemyHP[i], state.enemyAlive[i]);
+        }
+        selectedCard = -1;
+        currentState = SELECT_CARD;
+        updateStatusText();
+        updateActionText();
+    }
+
+    void pushUndo(const Snapshot& snapshot) {
+        if (undoCount == HISTORY_SIZE) {
+            undoStart = (undoStart + 1) % HISTORY_SIZE;
+            undoCount--;
+        }
+        undoHistory[(undoStart + undoCount++) % HISTORY_SIZE] = snapshot;
+    }
+
+    void clearHistory() {
+        undoStart = undoCount = redoCount = 0;
+    }
+
+    void undo() {
+        if (!undoCount) return;
+        const Snapshot& previous = undoHistory[(undoStart + --undoCount) % HISTORY_SIZE];
+        redoHistory[redoCount++] = capture(previous.discarded);
+        if (previous.discarded >= 0) deck.retract(previous.discarded);
+        restore(previous);
+    }
+
+    void redo() {
+        if (!redoCount) return;
+        const Snapshot& next = redoHistory[--redoCount];
+        pushUndo(capture(next.discarded));
+        if (next.discarded >= 0) deck.discard(next.discarded);
+        restore(next);
+    }
+
+    // Copies HP from the sprite-owning objects into the battle state.
+    void syncState() {
+        state.playerHP = player.getHP();
+        state.playerMaxHP = player.getMaxHP();
+        state.enemyCount = enemyCount;
+        for (int i = 0; i < enemyCount; i++) {
+            state.enemyHP[i] = enemies[i]->getHP();
+            state.enemyType[i] = enemies[i]->getEnemyType();
+            state.enemyAlive[i] = enemies[i]->isAlive();
+        }
+    }
+
+    // Plays back what a card did to the state through the objects, so hits and heals animate.
+    void applyState(const BattleState& before, bool areaCard) {
+        for (int i = 0; i < enemyCount; i++) {
+            int damage = before.enemyHP[i] - state.enemyHP[i];
+            if (damage > 0 && enemies[i]->isAlive()) {
+                enemies[i]->takeDMG(damage);
+                particles.emit(ParticleSystem::HIT_SPARK, effectPoint(enemyMotion[i]));
+                if (areaCard) particles.emit(ParticleSystem::SPELL_BURST, effectPoint(enemyMotion[i]));
+            }
+        }
+        int healed = state.playerHP - before.playerHP;
+        if (healed > 0) {
+            player.heal(healed);
+            particles.emit(ParticleSystem::HEAL_MOTE, effectPoint(playerMotion));
+        }
+        else if (healed < 0) {
+            player.takeDMG(-healed);
+        }
+        if (state.statusActive[BattleState::POWER] != before.statusActive[BattleState::POWER] ||
+            state.statusValue[BattleState::POWER][BattleState::PLAYER] != before.statusValue[BattleState::POWER][BattleState::PLAYER]) {
+            particles.emit(ParticleSystem::SPELL_BURST, effectPoint(playerMotion), 60);
+        }
+    }
+
+    // Roughly the middle of a character's body
+    Vector2f effectPoint(const Motion& motion) const {
+        return Vector2f(motion.home.x, motion.home.y - 20.f);
+    }
+
+    void playSelectedCard(int targetEnemy) {
+        if (selectedCard == -1) return;
+
+        int id = hand[selectedCard];
+        const CardLibrary::Definition& card = CardLibrary::instance().get(id);
+        if (player.getCurrentMana() < card.cost) return;
+
+        Snapshot snapshot = capture(-1);
+        BattleState before = state;
+        if (!CardLibrary::instance().play(id, deck.getLevel(id), state, targetEnemy)) {
+            LOG_INFO(Log::Cards, "%s already used this battle!", card.name.c_str());
+            selectedCard = -1;
+            currentState = SELECT_CARD;
+            updateActionText();
+            return;
+        }
+        applyState(before, card.target == CardLibrary::TARGET_ALL);
+        updateStatusText();
+        LOG_DEBUG(Log::Cards, "Played %s (level %d)", card.name.c_str(), deck.getLevel(id));
+
+        if (card.target != CardLibrary::TARGET_SELF) {
+            player.playAttack();
+            playerMotion.lungeTime = LUNGE_DURATION;
+        }
+
+        player.spendMana(card.cost);
+        snapshot.discarded = deck.discard(id) ? id : -1; // Return to discard pile
+        pushUndo(snapshot);
+        redoCount = 0;
+        hand[selectedCard] = -1;
+        cardsInHand--;
+
+        selectedCard = -1;
+        currentState = SELECT_CARD;
+        updateActionText();
+    }
+
+    void endPlayerTurn() {
+        clearHistory();
+        playerTurn = false;
+        updateTurnText();
+    }
+
+    void startPlayerTurn() {
+        clearHistory();
+        playerTurn = true;
+        player.resetMana();
+        state.tickStatuses();
+        updateStatusText();
+        fillHand();
+        currentState = SELECT_CARD;
+        updateTurnText();
+        updateActionText();
+    }
+
+    // The enemy turn plays out over ticks, one attacker every ENEMY_ATTACK_DELAY,
+    // so input and rendering keep running while it resolves.
+    void updateEnemyTurn(float dt) {
+        if (currentState != PROCESSING) {
+            currentState = PROCESSING;
+            nextAttacker = 0;
+            enemyTurnTimer = 0.f;
+            updateActionText();
+            updateTurnText();
+        }
+
+        enemyTurnTimer -= dt;
+        if (enemyTurnTimer > 0.f) return;
+
+        while (nextAttacker < enemyCount && !(enemies[nextAttacker] && enemies[nextAttacker]->isAlive())) {
+            nextAttacker++;
+        }
+        if (nextAttacker < enemyCount) {
+            int damage = state.enemyDamage(nextAttacker, enemies[nextAttacker]->rollDamage());
+            enemies[nextAttacker]->playAttack();
+            player.takeDMG(damage);
+            if (damage > 0) particles.emit(ParticleSystem::HIT_SPARK, effectPoint(playerMotion));
+            enemyMotion[nextAttacker].lungeTime = LUNGE_DURATION;
+            nextAttacker++;
+            enemyTurnTimer = ENEMY_ATTACK_DELAY;
+        }
+        else {
+            startPlayerTurn();
+        }
+    }
+
+    void updateBattleState(float dt) {
+        Animation::tick(dt);
+        particles.update(dt);
+        stepMotion(playerMotion, dt);
+        for (int i = 0; i < enemyCount; i++) {
+            stepMotion(enemyMotion[i], dt);
+        }
+
+        if (!playerTurn) {
+            updateEnemyTurn(dt);
+        }
+    }
+
+    bool checkBattleEnd() {
+        bool allEnemiesDead = true;
+        for (int i = 0; i < enemyCount; i++) {
+            if (enemies[i] && enemies[i]->isAlive()) {
+                allEnemiesDead = false;
+                break;
+            }
+        }
+
+        if (allEnemiesDead) {
+            awardCoins();
+            battleOver = true;
+            playerWon = true;
+        }
+        else if (!player.isAlive()) {
+            battleOver = true;
+            playerWon = false;
+        }
+        else {
+            return false;
+        }
+
+        cleanup();
+        finish(playerWon ? WON : LOST);
+        return true;
+    }
+
+    void handleInput(const InputSystem::Input& input) override {
+        if (!playerTurn) return;
+
+        if (input.action == InputSystem::CONFIRM) {
+            endPlayerTurn();
+        }
+        else if (currentState == SELECT_CARD) {
+            if (input.action == InputSystem::SELECT && input.slot < 4) {
+                handleCardSelection(input.slot + 1);
+            }
+            else if (input.action == InputSystem::TOGGLE_HINT) {
+                showHint = !showHint;
+                updateHint();
+            }
+            else if (input.action == InputSystem::UNDO) {
+                undo();
+            }
+            else if (input.action == InputSystem::REDO) {
+                redo();
+            }
+        }
+        else if (currentState == SELECT_ENEMY) {
+            if (input.action == InputSystem::SELECT && input.slot < 4) {
+                handleEnemySelection(input.slot + 1);
+            }
+            else if (input.action == InputSystem::BACK) {
+                currentState = SELECT_CARD;
+                selectedCard = -1;
+                updateActionText();
+            }
+        }
+    }
+
+    void tick(float dt) override {
+        if (battleOver) return;
+        updateBattleState(dt);
+        checkBattleEnd();
+    }
+
+    const char* sceneName() const override { return "Battle"; }
+
+    // Enemies first, then the player and the opening hand.
+    bool prepare() override {
+        switch (prepareStep++) {
+        case 0:
+            setupEnemies();
+            return false;
+        default:
+            placePlayer();
+            updateTurnText();
+            updateStatusText();
+            fillHand();
+            return true;
+        }
+    }
+
+    void buildFrame(RenderSnapshot& frame) override {
+        frame.clear();
+
+        if (backgroundLayer.isDirty()) {
+            RenderSnapshot& layer = backgroundLayer.rebuild();
+            layer.draw(background);
+            layer.draw(hpBox);
+            layer.draw(manaBox);
+        }
+        frame.draw(backgroundLayer);
+
+        // Draw enemies
+        for (int i = 0; i < enemyCount; i++) {
+            if (enemies[i]) {
+                enemies[i]->getSprite().setPosition(enemyMotion[i].current);
+                frame.draw(enemies[i]->getSprite(), enemyMotion[i].previous);
+            }
+        }
+
+        // Draw player
+        player.getSprite().setPosition(playerMotion.current);
+        frame.draw(player.getSprite(), playerMotion.previous);
+
+        particles.draw(frame);
+
+        // Status effects sit under whoever they're on
+        for (int entity = 0; entity < BattleState::ENTITIES; entity++) {
+            if (statusTexts[entity].getString().isEmpty()) continue;
+            Vector2f home = entity == BattleState::PLAYER ? playerMotion.home : enemyMotion[entity - 1].home;
+            statusTexts[entity].setPosition(home.x, home.y + 8);
+            frame.draw(statusTexts[entity], 0.5f);
+        }
+
+        // Hint frames go behind the cards
+        if (currentState == SELECT_CARD && playerTurn) {
+            for (int step = 0; step < hint.plays; step++) {
+                frame.draw(hintFrames[step]);
+            }
+        }
+
+        // Draw cards
+        if (handLayer.isDirty()) {
+            RenderSnapshot& layer = handLayer.rebuild();
+            for (int i = 0; i < 4; i++) {
+                if (hand[i] >= 0) {
+                    // Position cards vertically
+                    handSprites[i].setPosition(CARD_POSITIONS[i]);
+                    layer.draw(handSprites[i]);
+                }
+            }
+            layer.draw(actionText);
+        }
+        frame.draw(handLayer);
+
+        if (currentState == SELECT_CARD && playerTurn) {
+            for (int step = 0; step < hint.plays; step++) {
+                frame.draw(hintCardLabels[step], 0.5f);
+                if (hint.target[step] >= 0) frame.draw(hintTargetLabels[step], 0.5f);
+            }
+        }
+
+        // Enlarged preview of the card waiting for a target
+        if (currentState == SELECT_ENEMY && selectedCard >= 0 && hand[selectedCard] >= 0) {
+            previewSprite.setTexture(CardArt::get(CardLibrary::instance().get(hand[selectedCard]).art, CardArt::PREVIEW), true);
+            float scale = PREVIEW_SCALE / CardArt::scaleOf(CardArt::PREVIEW);
+            previewSprite.setScale(scale, scale);
+            previewSprite.setPosition(20, 120);
+            frame.draw(previewSprite);
+        }
+
+        // Draw UI
+        HudFont::Line(frame, 24, Vector2f(910, 650), Color::White)
+            .word(HudFont::HP).number(player.getHP()).character('/').number(player.getMaxHP());
+        HudFont::Line(frame, 24, Vector2f(1160, 650), Color::White)
+            .word(HudFont::MANA).number(player.getCurrentMana()).character('/').number(player.getMaxMana());
+        frame.draw(turnText, 0.5f);
+    }
+
+public:
+    // Loads the arena once; begin() sets up each fight.
+    Battle(Player& p, Deck& d) :
+        player(p), deck(d), node(0), prepareStep(0), enemyCount(0),
+        playerTurn(true), battleOver(true), playerWon(false),
+        cardsInHand(0), selectedCard(-1), selectedEnemy(-1),
+        showHint(false), nextAttacker(0), enemyTurnTimer(0.f), undoStart(0), undoCount(0), redoCount(0), currentState(SELECT_CARD) {
+
+        for (int i = 0; i < 4; i++) {
+            enemies[i] = nullptr;
+            hand[i] = -1;
+        }
+
+        if (!TextureLoader::tryLoadFont(font, "Fonts/American Captain.ttf")) {
+            LOG_ERROR(Log::Assets, "Failed to load battle resources!");
+        }
+
+        // Enemy sheets come in with the background rather than one by one on the first spawns
+        TextureCache::Batch batch;
+        batch.add("battle.png", TextureCache::MAP);
+        for (int type = 0; type < EncounterTable::ENEMY_TYPES; type++) {
+            batch.add(Enemy::sheet(type, false), TextureCache::CHARACTERS);
+            batch.add(Enemy::sheet(type, true), TextureCache::CHARACTERS);
+        }
+        TextureCache::instance().load(batch);
+        background.setTexture(TextureCache::instance().get("battle.png", TextureCache::MAP));
+        setupUI();
+    }
+
+    ~Battle() {
+        cleanup();
+    }
+
+    // Resets for a fight at the given map node; push the battle afterwards.
+    void begin(int mapNode) {
+        cleanup();
+        node = mapNode;
+        prepareStep = 0;
+        enemyCount = 0;
+        playerTurn = true;
+        battleOver = false;
+        playerWon = false;
+        selectedCard = -1;
+        selectedEnemy = -1;
+        showHint = false;
+        nextAttacker = 0;
+        enemyTurnTimer = 0.f;
+        currentState = SELECT_CARD;
+        state = BattleState();
+        hint = TurnSolver::Line();
+        clearHistory();
+        particles.clear();
+    }
+};
+class Shop : public Scene {
+public:
+    static const int REFILL_PRICE = 20;
+    static const int MAX_HP_PRICE = 50;
+    static const int MAX_MANA_PRICE = 50;
+
+private:
+    Player* player;
+    Deck* deck;
+
+    Sprite crossSprite;
+    static const int CARD_SLOTS = 7;
+    static const int SELECTIONS = CARD_SLOTS + 3; // Keys 1-9, then 0
+    Sprite cardSprites[CARD_SLOTS]; // Card ids in file order
+    int cardCount; // Cards on offer, at most one per slot
+    Sprite upgradeSprites[3];
+    Font font;
+    Vector2f pricePositions[SELECTIONS]; // Cards, then upgrades
+    Text selectionTexts[SELECTIONS]; // Numbers for selection
+    Text instructions;
+    StaticLayer shopLayer; // Whole screen; redrawn after purchases
+    int upgradePrices[3] = { REFILL_PRICE, MAX_HP_PRICE, MAX_MANA_PRICE }; // Rise with each purchase this visit
+
+    // Card positions
+    const Vector2f CARD_POSITIONS[CARD_SLOTS] = {
+        Vector2f(150, 150),  // (1)
+        Vector2f(330, 150),  // (2)
+        Vector2f(510, 150),  // (3)
+        Vector2f(690, 150),  // (4)
+        Vector2f(150, 350),  // (5)
+        Vector2f(330, 350),  // (6)
+        Vector2f(510, 350)   // (7)
+    };
+
+    // Upgrade positions
+    const Vector2f UPGRADE_POSITIONS[3] = {
+        Vector2f(690, 350),  // Refill HP (8)
+        Vector2f(870, 150),  // Increase HP (9)
+        Vector2f(870, 350)   // Increase Mana (0)
+    };
+
+    void purchase(int selection) {
+        if (selection < CARD_SLOTS) { // Card selection
+            if (selection >= cardCount) return;
+            const CardLibrary::Definition& card = CardLibrary::instance().get(selection);
+            int price = deck->getPrice(selection);
+            if (player->getCoins() < price) return;
+
+            if (deck->owns(selection)) { // Upgrade
+                if (!card.upgradable) return;
+                player->buy(price);
+                deck->upgrade(selection);
+            }
+            else { // Unlock
+                player->buy(price);
+                for (int j = 0; j < card.unlockCopies; j++) {
+                    deck->addCard(selection);
+                }
+            }
+        }
+        else if (selection < SELECTIONS) { // Upgrade selection
+            int upgradeIndex = selection - CARD_SLOTS;
+            if (player->getCoins() >= upgradePrices[upgradeIndex]) {
+                player->buy(upgradePrices[upgradeIndex]);
+                switch (upgradeIndex) {
+                case 0: // Refill HP
+                    player->heal(player->getMaxHP() - player->getHP());
+                    break;
+                case 1: // Increase HP
+                    player->setMaxHP(player->getMaxHP() + 5);
+                    player->heal(5);
+                    upgradePrices[upgradeIndex] += 20;
+                    break;
+                case 2: // Increase Mana
+                    player->increaseMaxMana(1);
+                    upgradePrices[upgradeIndex] += 25;
+                    break;
+                }
+            }
+        }
+    }
+
+    void handleInput(const InputSystem::Input& input) override {
+        if (input.action == InputSystem::BACK) {
+            finish(); // Exit shop
+            return;
+        }
+
+        // Keys 1-9 then 0
+        if (input.action == InputSystem::SELECT && input.slot < SELECTIONS) {
+            purchase(input.slot);
+            shopLayer.invalidate();
+        }
+    }
+
+    void tick(float dt) override {}
+
+    const char* sceneName() const override { return "Shop"; }
+
+    void buildFrame(RenderSnapshot& frame) override {
+        frame.clear(Color::Black);
+
+        if (shopLayer.isDirty()) {
+            RenderSnapshot& layer = shopLayer.rebuild();
+
+            // Draw cards
+            for (int i = 0; i < cardCount; i++) {
+                layer.draw(cardSprites[i]);
+                layer.draw(selectionTexts[i]);
+                bool owned = deck->owns(i);
+                if (owned && !CardLibrary::instance().get(i).upgradable) continue;
+                int price = deck->getPrice(i);
+                HudFont::Line(layer, 18, pricePositions[i], player->getCoins() >= price ? Color::White : Color::Red)
+                    .word(owned ? HudFont::UPGRADE : HudFont::UNLOCK)
+                    .number(price).word(HudFont::COINS_SUFFIX);
+            }
+
+            // Draw upgrades
+            for (int i = 0; i < 3; i++) {
+                layer.draw(upgradeSprites[i]);
+                layer.draw(selectionTexts[i + CARD_SLOTS]);
+                HudFont::Line(layer, 18, pricePositions[i + CARD_SLOTS], player->getCoins() >= upgradePrices[i] ? Color::White : Color::Red)
+                    .number(upgradePrices[i]).word(HudFont::COINS_SUFFIX);
+            }
+
+            // Draw UI elements
+            layer.draw(crossSprite);
+            HudFont::Line(layer, 30, Vector2f(1000, 650), Color::Yellow) // Bottom right position
+                .word(HudFont::COINS).number(player->getCoins());
+            layer.draw(instructions);
+        }
+        frame.draw(shopLayer);
+    }
+
+public:
+    Shop(Player& p, Deck& d) : player(&p), deck(&d) {
+        const CardLibrary& library = CardLibrary::instance();
+        cardCount = min(library.count(), (int)CARD_SLOTS);
+
+        // Upgrade icons (0=RefillHP, 1=IncreaseHP, 2=IncreaseMana)
+        string upgradeFiles[3] = { "rhp.png", "ihp.png", "im.png" };
+        TextureCache& textures = TextureCache::instance();
+        TextureCache::Batch batch;
+        batch.add("cross.png", TextureCache::UI);
+        for (int i = 0; i < cardCount; i++) {
+            CardArt::request(batch, library.get(i).art, CardArt::THUMBNAIL);
+        }
+        for (int i = 0; i < 3; i++) {
+            batch.add(upgradeFiles[i], TextureCache::UI);
+        }
+        textures.load(batch);
+
+        crossSprite.setTexture(textures.get("cross.png", TextureCache::UI));
+        crossSprite.setPosition(1200, 20);
+
+        // Card thumbnails are shared with the battle hand
+        float cardScale = 0.1f / CardArt::scaleOf(CardArt::THUMBNAIL); // Smaller card size
+        for (int i = 0; i < cardCount; i++) {
+            cardSprites[i].setTexture(CardArt::get(library.get(i).art, CardArt::THUMBNAIL));
+            cardSprites[i].setPosition(CARD_POSITIONS[i]);
+            cardSprites[i].setScale(cardScale, cardScale);
+        }
+
+        // Upgrade icons, made smaller
+        for (int i = 0; i < 3; i++) {
+            upgradeSprites[i].setTexture(textures.get(upgradeFiles[i], TextureCache::UI));
+            upgradeSprites[i].setPosition(UPGRADE_POSITIONS[i]);
+            upgradeSprites[i].setScale(0.2f, 0.2f);
+        }
+
+        // Load font
+        if (!TextureLoader::tryLoadFont(font, "Fonts/American Captain.ttf")) {
+            LOG_ERROR(Log::Assets, "Failed to load font!");
+        }
+
+        // Setup selection texts; prices are drawn from the HUD atlas
+        for (int i = 0; i < SELECTIONS; i++) {
+            selectionTexts[i].setFont(font);
+            selectionTexts[i].setCharacterSize(24);
+            selectionTexts[i].setFillColor(Color::Yellow);
+            selectionTexts[i].setString("[" + to_string((i + 1) % 10) + "]");
+        }
+
+        // Position price texts further below cards/upgrades
+        for (int i = 0; i < CARD_SLOTS; i++) {
+            pricePositions[i] = Vector2f(CARD_POSITIONS[i].x, CARD_POSITIONS[i].y + 60); // Pushed down
+            selectionTexts[i].setPosition(CARD_POSITIONS[i].x - 30, CARD_POSITIONS[i].y);
+        }
+        for (int i = 0; i < 3; i++) {
+            pricePositions[i + CARD_SLOTS] = Vector2f(UPGRADE_POSITIONS[i].x, UPGRADE_POSITIONS[i].y + 120); // Pushed down
+            selectionTexts[i + CARD_SLOTS].setPosition(UPGRADE_POSITIONS[i].x - 30, UPGRADE_POSITIONS[i].y);
+        }
+
+        // Instruction text
+        instructions.setFont(font);
+        instructions.setCharacterSize(24);
+        instructions.setFillColor(Color::White);
+        instructions.setString("Press 1-9 or 0 to select, ESCAPE to exit");
+        instructions.setPosition(50, 600);
+    }
+
+    // Resets the per-visit prices; push the shop afterwards.
+    void begin() {
+        upgradePrices[0] = REFILL_PRICE;
+        upgradePrices[1] = MAX_HP_PRICE;
+        upgradePrices[2] = MAX_MANA_PRICE;
+        shopLayer.invalidate();
+    }
+};
+// Which map nodes exist and what follows each. Map lays it out on screen;
+// RunSimulator walks it headless.
+class MapGraph {
+public:
+    enum NodeType { BATTLE, SHOP, REFILL };
+
+    static const int NODE_COUNT = 9;
+    static const int FINAL_NODE = 8; // Boss battle
+
+    static NodeType type(int node) {
+        static const NodeType types[NODE_COUNT] = { BATTLE, SHOP, BATTLE, BATTLE, BATTLE, SHOP, SHOP, REFILL, BATTLE };
+        return types[node];
+    }
+
+    // Nodes open after clearing `node` (-1 before the first); none after the boss.
+    static int next(int node, int options[2]) {
+        switch (node) {
+        case -1: options[0] = 0; return 1;
+        case 0: options[0] = 1; options[1] = 2; return 2;
+        case 1:
+        case 2: options[0] = 3; return 1;
+        case 3: options[0] = 4; options[1] = 5; return 2;
+        case 4:
+        case 5: options[0] = 6; options[1] = 7; return 2;
+        case 6:
+        case 7: options[0] = FINAL_NODE; return 1;
+        default: return 0;
+        }
+    }
+};
+
+// Estimates, for each way forward from a map node, the chance of winning the
+// run and the expected HP and coins at the end. Battles are modelled by how
+// much damage the player takes at each stage of the map, fitted once from
+// headless battles (TurnSolver playing a starter deck) and nudged by the
+// battles actually fought. A backward pass over the node graph then picks
+// the best branch for every HP. Values are kept per node; when one battle
+// model changes, only the nodes that can reach it are solved again.
+class RouteAdvisor {
+public:
+    struct Estimate {
+        float winChance;
+        float endHP;
+        float coins; // Gained from here to the end of the run
+    };
+
+private:
+    static const int MAX_HP = 100; // Higher HP is treated as this much
+    static const int NODES = MapGraph::NODE_COUNT + 1; // Index 0 is the start, before node 0
+    static const int FIT_BATTLES = 1000; // Headless battles per model
+    static const int REAL_BATTLE_WEIGHT = 50; // A fought battle counts as this many headless ones
+    static const int MAX_TURNS = 50;
+
+    // Damage taken over a whole battle entered from one node (encounters
+    // depend on it); the last bucket is MAX_HP or more, including timeouts.
+    struct BattleModel {
+        double damage[MAX_HP + 1];
+        double battles;
+        double wonCoins; // Mean coins for a win
+        bool used;
+    };
+
+    BattleModel models[NODES];
+    Estimate values[NODES][MAX_HP + 1]; // Just cleared the node with this HP, next choice still to make
+    bool dirty[NODES];
+    int order[NODES]; // Successors before predecessors
+    int maxHP;
+    bool fitted;
+    int solves; // Nodes solved since the last recorded battle
+
+    static int index(int node) { return node + 1; }
+
+    // One battle as RunSimulator plays it, with HP to spare so the full damage shows.
+    static int damageTaken(int node, TurnSolver& solver, Random& random, int& coins) {
+        const CardLibrary& library = CardLibrary::instance();
+        const int spareHP = 1000;
+        Deck deck(random);
+        BattleState state = BattleState();
+        state.playerHP = state.playerMaxHP = spareHP;
+        state.spawnEnemies(node, random);
+
+        int hand[TurnSolver::HAND_SIZE] = { -1, -1, -1, -1 };
+        for (int turn = 1; turn <= MAX_TURNS; turn++) {
+            if (turn > 1) state.tickStatuses();
+            for (int i = 0; i < TurnSolver::HAND_SIZE; i++) {
+                if (hand[i] >= 0) deck.discard(hand[i]);
+                hand[i] = deck.draw();
+            }
+            int mana = 5; // A new Player's
+            TurnSolver::Line line = solver.solve(state, hand, deck, mana);
+            for (int step = 0; step < line.plays; step++) {
+                int id = hand[line.slot[step]];
+                library.play(id, deck.getLevel(id), state, line.target[step]);
+                mana -= library.get(id).cost;
+                deck.discard(id);
+                hand[line.slot[step]] = -1;
+            }
+            if (state.firstAliveEnemy() < 0) {
+                coins = BattleState::VICTORY_COINS;
+                for (int i = 0; i < state.enemyCount; i++) coins += BattleState::coinReward(state.enemyType[i]);
+                return max(0, spareHP - state.playerHP);
+            }
+            for (int i = 0; i < state.enemyCount; i++) {
+                if (state.enemyAlive[i]) state.playerHP -= state.enemyDamage(i, BattleState::rollAttack(state.enemyType[i], random));
+            }
+        }
+        coins = 0;
+        return MAX_HP;
+    }
+
+    void fit() {
+        vector<int> battleNodes;
+        for (int node = -1; node < MapGraph::NODE_COUNT; node++) {
+            int options[2];
+            int count = MapGraph::next(node, options);
+            BattleModel& model = models[index(node)];
+            model = BattleModel();
+            for (int i = 0; i < count; i++) {
+                if (MapGraph::type(options[i]) == MapGraph::BATTLE) model.used = true;
+            }
+            if (model.used) battleNodes.push_back(node);
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        WorkerPool::instance().forEach((int)battleNodes.size(), [&](int job) {
+            int node = battleNodes[job];
+            BattleModel& model = models[index(node)];
+            TurnSolver solver;
+            Random random(0x5EEDull + (Uint64)job);
+            double coinTotal = 0.0, wins = 0.0;
+            for (int i = 0; i < FIT_BATTLES; i++) {
+                int coins = 0;
+                int damage = min((int)MAX_HP, damageTaken(node, solver, random, coins));
+                model.damage[damage] += 1.0;
+                if (damage < MAX_HP) {
+                    coinTotal += coins;
+                    wins += 1.0;
+                }
+            }
+            model.battles = FIT_BATTLES;
+            model.wonCoins = wins > 0.0 ? coinTotal / wins : 0.0;
+        });
+        fitted = true;
+        LOG_INFO(Log::Game, "Route advisor: fitted %d battle models in %.1f ms", (int)battleNodes.size(),
+            chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+
+    // Depth-first from the start; a node is placed after everything it leads to.
+    void buildOrder() {
+        bool placed[NODES] = {};
+        int count = 0;
+        int stack[NODES], next[NODES];
+        int depth = 0;
+        stack[depth] = -1;
+        next[depth] = 0;
+        placed[index(-1)] = true;
+        while (depth >= 0) {
+            int node = stack[depth];
+            int options[2];
+            int optionCount = MapGraph::next(node, options);
+            if (next[depth] < optionCount) {
+                int child = options[next[depth]++];
+                if (!placed[index(child)]) {
+                    placed[index(child)] = true;
+                    depth++;
+                    stack[depth] = child;
+                    next[depth] = 0;
+                }
+                continue;
+            }
+            order[count++] = node;
+            depth--;
+        }
+        for (int node = -1; node < MapGraph::NODE_COUNT; node++) {
+            if (!placed[index(node)]) order[count++] = node; // Unreachable; solved alone
+        }
+    }
+
+    // Taking `option` from `node` with `hp` left.
+    Estimate evaluate(int node, int option, int hp) const {
+        Estimate result = { 0.f, 0.f, 0.f };
+        switch (MapGraph::type(option)) {
+        case MapGraph::BATTLE: {
+            const BattleModel& model = models[index(node)];
+            if (model.battles <= 0.0) return result;
+            for (int damage = 0; damage < hp && damage < MAX_HP; damage++) {
+                if (model.damage[damage] <= 0.0) continue;
+                float chance = (float)(model.damage[damage] / model.battles);
+                const Estimate& after = values[index(option)][hp - damage];
+                result.winChance += chance * after.winChance;
+                result.endHP += chance * after.endHP;
+                result.coins += chance * ((float)model.wonCoins + after.coins);
+            }
+            return result;
+        }
+        case MapGraph::SHOP: {
+            bool refill = hp < maxHP / 2; // As RunSimulator's shop policy
+            result = values[index(option)][refill ? maxHP : hp];
+            if (refill) result.coins -= Shop::REFILL_PRICE;
+            return result;
+        }
+        default:
+            return values[index(option)][maxHP];
+        }
+    }
+
+    static bool better(const Estimate& a, const Estimate& b) {
+        if (a.winChance != b.winChance) return a.winChance > b.winChance;
+        return a.endHP > b.endHP;
+    }
+
+    void solveNode(int node) {
+        int options[2];
+        int count = MapGraph::next(node, options);
+        Estimate* row = values[index(node)];
+        for (int hp = 0; hp <= maxHP; hp++) {
+            if (hp == 0) {
+                row[hp] = Estimate{ 0.f, 0.f, 0.f };
+                continue;
+            }
+            if (count == 0) {
+                row[hp] = Estimate{ 1.f, (float)hp, 0.f }; // Past the boss
+                continue;
+            }
+            Estimate best = evaluate(node, options[0], hp);
+            for (int i = 1; i < count; i++) {
+                Estimate candidate = evaluate(node, options[i], hp);
+                if (better(candidate, best)) best = candidate;
+            }
+            row[hp] = best;
+        }
+        dirty[index(node)] = false;
+        solves++;
+    }
+
+    // Marks the node and every node that can reach it.
+    void invalidate(int node) {
+        if (dirty[index(node)]) return;
+        dirty[index(node)] = true;
+        for (int from = -1; from < MapGraph::NODE_COUNT; from++) {
+            int options[2];
+            int count = MapGraph::next(from, options);
+            for (int i = 0; i < count; i++) {
+                if (options[i] == node) invalidate(from);
+            }
+        }
+    }
+
+    void solve(int playerMaxHP) {
+        if (!fitted) {
+            fit();
+            buildOrder();
+        }
+        playerMaxHP = min((int)MAX_HP, max(1, playerMaxHP));
+        if (playerMaxHP != maxHP) {
+            maxHP = playerMaxHP;
+            for (int i = 0; i < NODES; i++) dirty[i] = true;
+        }
+        for (int i = 0; i < NODES; i++) {
+            if (dirty[index(order[i])]) solveNode(order[i]);
+        }
+    }
+
+    RouteAdvisor() : maxHP(0), fitted(false), solves(0) {
+        for (int i = 0; i < NODES; i++) dirty[i] = true;
+    }
+
+public:
+    static RouteAdvisor& instance() {
+        static RouteAdvisor advisor;
+        return advisor;
+    }
+
+    // Startup warm-up; otherwise the first advice fits the models.
+    void prepare(int playerMaxHP) { solve(playerMaxHP); }
+
+    // Estimates for each option after `node` (-1 before the first); returns the advised option index.
+    int advise(int node, int hp, int playerMaxHP, Estimate estimates[2]) {
+        solve(playerMaxHP);
+        hp = min(maxHP, max(0, hp));
+        int options[2];
+        int count = MapGraph::next(node, options);
+        int best = 0;
+        for (int i = 0; i < count; i++) {
+            estimates[i] = evaluate(node, options[i], hp);
+            if (i > 0 && better(estimates[i], estimates[best])) best = i;
+        }
+        return best;
+    }
+
+    // A battle entered from `node` was fought; folds its damage into that model.
+    void recordBattle(int node, int damage) {
+        BattleModel& model = models[index(node)];
+        if (!fitted || !model.used) return;
+        model.damage[min((int)MAX_HP, max(0, damage))] += REAL_BATTLE_WEIGHT;
+        model.battles += REAL_BATTLE_WEIGHT;
+        solves = 0;
+        invalidate(node);
+        solve(maxHP);
+        LOG_DEBUG(Log::Game, "Route advisor: battle from node %d took %d HP, re-solved %d nodes", node, damage, solves);
+    }
+};
+
+// Streams a tiled background in around the view. A loader thread fills tile
+// pixels and the game thread uploads them into a fixed set of slot textures,
+// so memory follows the view size, not the image size. Tiles that are still
+// loading draw as a flat placeholder colour.
+class TileStreamer {
+private:
+    static const int TILE = BackgroundTiles::TILE_SIZE;
+    static const int SLOT_COUNT = 48; // 8x6 tiles: a 1280x720 view plus a one-tile margin
+    static const unsigned QUEUE_SIZE = 64; // power of two, more than SLOT_COUNT
+
+    enum Source { PACKED_TILES, PACKED_IMAGE, IMAGE_FILE };
+    enum SlotState { FREE, LOADING, LOADED, RESIDENT };
+
+    struct Slot {
+        Texture texture;
+        vector<Uint8> pixels; // Written by the loader while LOADING
+        unsigned width;
+        unsigned height;
+        int column;
+        int row;
+        atomic<int> state;
+        unsigned long long lastDrawn; // Frame sequence, as TextureCache counts them
+
+        Slot() : width(0), height(0), column(-1), row(-1), state(FREE), lastDrawn(0) {}
+    };
+
+    string filename;
+    Source source;
+    Color placeholder;
+    unsigned width; // Whole image; set by the loader when it has to decode the file
+    unsigned height;
+    int columns;
+    int rows;
+    atomic<bool> sized;
+
+    Slot slots[SLOT_COUNT];
+
+    // Single-producer/single-consumer: the game thread queues slots, the loader takes them.
+    int queue[QUEUE_SIZE];
+    atomic<unsigned> queueHead;
+    atomic<unsigned> queueTail;
+
+    atomic<bool> running;
+    thread* loader;
+    Image decoded; // Loader thread only, when nothing is packed
+
+    IntRect wanted; // Tiles to keep: the view plus the margin
+    RectangleShape placeholderShape;
+    Sprite tileSprite;
+    int uploads;
+    int evictions;
+
+    void readTile(Slot& slot) {
+        const AssetPack& pack = AssetPack::instance();
+        if (source == PACKED_TILES) {
+            const AssetPack::Entry* tile = pack.find(BackgroundTiles::tileName(filename, slot.column, slot.row));
+            if (tile && tile->type == AssetPack::IMAGE && tile->width <= TILE && tile->height <= TILE) {
+                slot.width = tile->width;
+                slot.height = tile->height;
+                memcpy(&slot.pixels[0], pack.data(*tile), (size_t)tile->size);
+                return;
+            }
+            LOG_WARN(Log::Assets, "%s: tile %d,%d missing from the pack or oversized", filename.c_str(), slot.column, slot.row);
+            slot.width = slot.height = 0;
+        }
+        else if (source == PACKED_IMAGE) {
+            const AssetPack::Entry* whole = pack.find(filename);
+            BackgroundTiles::copyTile(pack.data(*whole), width, height, slot.column, slot.row, &slot.pixels[0], slot.width, slot.height);
+        }
+        else {
+            BackgroundTiles::copyTile(decoded.getPixelsPtr(), width, height, slot.column, slot.row, &slot.pixels[0], slot.width, slot.height);
+        }
+    }
+
+    // Without a pack the whole file has to be decoded once; the tiles are cut from that.
+    void decodeSource() {
+        if (decoded.loadFromFile(filename)) {
+            width = decoded.getSize().x;
+            height = decoded.getSize().y;
+        }
+        else {
+            LOG_ERROR(Log::Assets, "Failed to load background: %s", filename.c_str());
+            width = height = 0;
+        }
+        columns = BackgroundTiles::tilesAcross(width);
+        rows = BackgroundTiles::tilesAcross(height);
+        sized.store(true, memory_order_release);
+    }
+
+    void loaderLoop() {
+        if (!sized.load(memory_order_acquire)) decodeSource();
+        while (running.load(memory_order_acquire)) {
+            unsigned tail = queueTail.load(memory_order_relaxed);
+            if (tail == queueHead.load(memory_order_acquire)) {
+                this_thread::sleep_for(chrono::milliseconds(2));
+                continue;
+            }
+            Slot& slot = slots[queue[tail & (QUEUE_SIZE - 1)]];
+            readTile(slot);
+            slot.state.store(LOADED, memory_order_release);
+            queueTail.store(tail + 1, memory_order_release);
+        }
+    }
+
+    IntRect tileRange(const FloatRect& view, int margin) const {
+        int left = max(0, (int)floor(view.left / TILE) - margin);
+        int top = max(0, (int)floor(view.top / TILE) - margin);
+        int right = min(columns, (int)ceil((view.left + view.width) / TILE) + margin);
+        int bottom = min(rows, (int)ceil((view.top + view.height) / TILE) + margin);
+        return IntRect(left, top, max(0, right - left), max(0, bottom - top));
+    }
+
+    static bool inRange(const IntRect& range, int column, int row) {
+        return column >= range.left && column < range.left + range.width && row >= range.top && row < range.top + range.height;
+    }
+
+    Slot* findSlot(int column, int row) {
+        for (Slot& slot : slots) {
+            if (slot.column == column && slot.row == row) return &slot;
+        }
+        return nullptr;
+    }
+
+    // An unused slot, else the least recently drawn tile outside the wanted
+    // range that no frame in flight still shows.
+    Slot* freeSlot() {
+        unsigned long long safe = TextureCache::instance().presentedSequence();
+        Slot* oldest = nullptr;
+        for (Slot& slot : slots) {
+            int state = slot.state.load(memory_order_acquire);
+            if (state == FREE) return &slot;
+            if (state != RESIDENT || slot.lastDrawn > safe || inRange(wanted, slot.column, slot.row)) continue;
+            if (!oldest || slot.lastDrawn < oldest->lastDrawn) oldest = &slot;
+        }
+        if (oldest) evictions++;
+        return oldest;
+    }
+
+    // Queues missing tiles row by row; stops when every slot is busy.
+    void request(const IntRect& range) {
+        for (int row = range.top; row < range.top + range.height; row++) {
+            for (int column = range.left; column < range.left + range.width; column++) {
+                if (findSlot(column, row)) continue;
+                Slot* slot = freeSlot();
+                if (!slot) return;
+                if (slot->pixels.empty()) {
+                    slot->pixels.resize(TILE * TILE * 4);
+                    slot->texture.create(TILE, TILE);
+                }
+                slot->column = column;
+                slot->row = row;
+                slot->state.store(LOADING, memory_order_relaxed);
+
+                unsigned head = queueHead.load(memory_order_relaxed);
+                queue[head & (QUEUE_SIZE - 1)] = (int)(slot - slots);
+                queueHead.store(head + 1, memory_order_release);
+            }
+        }
+    }
+
+public:
+    TileStreamer(const string& file, Color placeholderColor)
+        : filename(file), source(IMAGE_FILE), placeholder(placeholderColor), width(0), height(0), columns(0), rows(0),
+          sized(false), queueHead(0), queueTail(0), running(true), loader(nullptr), uploads(0), evictions(0) {
+        const AssetPack::Entry* packed = AssetPack::instance().find(filename);
+        if (packed && (packed->type == AssetPack::TILES || packed->type == AssetPack::IMAGE)) {
+            source = packed->type == AssetPack::TILES ? PACKED_TILES : PACKED_IMAGE;
+            width = packed->width;
+            height = packed->height;
+            columns = BackgroundTiles::tilesAcross(width);
+            rows = BackgroundTiles::tilesAcross(height);
+            sized.store(true, memory_order_release);
+        }
+        placeholderShape.setSize(Vector2f((float)TILE, (float)TILE));
+        placeholderShape.setFillColor(placeholder);
+        loader = new thread(&TileStreamer::loaderLoop, this);
+    }
+
+    ~TileStreamer() {
+        running.store(false, memory_order_release);
+        loader->join();
+        delete loader;
+        LOG_DEBUG(Log::Assets, "%s: %d tile uploads, %d evictions", filename.c_str(), uploads, evictions);
+    }
+
+    // Game thread, once per tick: uploads finished tiles and queues the ones the view needs next.
+    void update(const FloatRect& view) {
+        if (!sized.load(memory_order_acquire)) return;
+        for (Slot& slot : slots) {
+            if (slot.state.load(memory_order_acquire) != LOADED) continue;
+            if (slot.width > 0) slot.texture.update(&slot.pixels[0], slot.width, slot.height, 0, 0);
+            slot.state.store(RESIDENT, memory_order_relaxed);
+            uploads++;
+        }
+        wanted = tileRange(view, 1);
+        request(tileRange(view, 0)); // On-screen tiles first
+        request(wanted);
+    }
+
+    // Draws the tiles under the view, with the view's top-left corner at the window origin.
+    void draw(RenderSnapshot& frame, const FloatRect& view) {
+        if (!sized.load(memory_order_acquire)) {
+            placeholderShape.setPosition(0, 0);
+            placeholderShape.setSize(Vector2f(view.width, view.height));
+            frame.draw(placeholderShape);
+            placeholderShape.setSize(Vector2f((float)TILE, (float)TILE));
+            return;
+        }
+
+        unsigned long long building = TextureCache::instance().buildingFrame();
+        IntRect visible = tileRange(view, 0);
+        for (int row = visible.top; row < visible.top + visible.height; row++) {
+            for (int column = visible.left; column < visible.left + visible.width; column++) {
+                Vector2f position(column * TILE - view.left, row * TILE - view.top);
+                Slot* slot = findSlot(column, row);
+                if (slot && slot->state.load(memory_order_acquire) == RESIDENT && slot->width > 0) {
+                    slot->lastDrawn = building;
+                    tileSprite.setTexture(slot->texture);
+                    tileSprite.setTextureRect(IntRect(0, 0, slot->width, slot->height));
+                    tileSprite.setPosition(position);
+                    frame.draw(tileSprite);
+                }
+                else {
+                    placeholderShape.setSize(Vector2f((float)min((int)TILE, (int)width - column * TILE), (float)min((int)TILE, (int)height - row * TILE)));
+                    placeholderShape.setPosition(position);
+                    frame.draw(placeholderShape);
+                }
+            }
+        }
+    }
+};
+
+class Map : public Scene {
+public:
+    enum Outcome { VICTORY = 1, DEFEAT = 2 };
+
+private:
+    Player& player;
+    Battle& battle;
+    Shop& shop;
+
+    struct Node {
+        Vector2f position;
+        int type; // 0=battle, 1=shop, 2=refill
+        bool active;
+        bool visited;
+        Sprite sprite;
+    };
+
+    vector<Node> nodes;
+    int currentNode;
+    int enteredNode; // Battle or shop node being visited, -1 when none
+    int battleStartHP; // For the route advisor's damage record
+    vector<int> currentOptions;
+    int advisedOption; // Index into currentOptions, -1 with a single option
+
+    const Texture* nodeTextures[3]; // Owned by TextureCache
+    TileStreamer background;
+    const FloatRect view = FloatRect(0, 0, 1280, 720); // Fixed for now; the background streams around it
+    Font font;
+
+    Text headerText;
+    Text nodeInfoText;
+    Color healthColor;
+    RectangleShape healthBox;
+
+    StaticLayer mapLayer; // Whole screen; redrawn when nodes or labels change
+
+    const float NODE_SCALE = 0.3f;
+    const Color VISITED_COLOR = Color(150, 150, 150, 200);
+    const Color ACTIVE_COLOR = Color::White;
+    const Color INACTIVE_COLOR = Color(100, 100, 100, 150);
+    const Color ADVISED_COLOR = Color(255, 225, 120);
+
+    void setupNodes() {
+        const Vector2f positions[MapGraph::NODE_COUNT] = {
+            Vector2f(100, 360),
+            Vector2f(250, 200), Vector2f(250, 520),
+            Vector2f(400, 360),
+            Vector2f(550, 200), Vector2f(550, 520),
+            Vector2f(700, 250), Vector2f(700, 470),
+            Vector2f(1000, 360)
+        };
+        for (int i = 0; i < MapGraph::NODE_COUNT; i++) {
+            int type = MapGraph::type(i);
+            nodes.push_back({ positions[i], type, false, false, Sprite(*nodeTextures[type]) });
+        }
+
+        for (auto& node : nodes) {
+            node.sprite.setScale(NODE_SCALE, NODE_SCALE);
+            node.sprite.setPosition(node.position);
+            node.sprite.setOrigin(node.sprite.getLocalBounds().width / 2,
+                node.sprite.getLocalBounds().height / 2);
+        }
+    }
+
+    void setupUI() {
+        headerText.setFont(font);
+        headerText.setString("MAGICKA");
+        headerText.setCharacterSize(48);
+        headerText.setPosition(640, 20); // Centred by the renderer
+
+        nodeInfoText.setFont(font);
+        nodeInfoText.setCharacterSize(24);
+        nodeInfoText.setPosition(20, 650);
+
+        healthBox.setSize(Vector2f(200, 30));
+        healthBox.setPosition(1060, 650);
+        healthBox.setFillColor(Color(50, 50, 50, 200));
+
+        updateHealthDisplay();
+    }
+
+    void updateHealthDisplay() {
+        float healthPercent = (float)player.getHP() / player.getMaxHP();
+
+        if (healthPercent > 0.75f) {
+            healthColor = Color::Green;
+        }
+        else if (healthPercent > 0.25f) {
+            healthColor = Color(255, 165, 0);
+        }
+        else {
+            healthColor = Color::Red;
+        }
+        if (!currentOptions.empty()) updateNodeText((int)currentOptions.size()); // Advice depends on HP
+        mapLayer.invalidate();
+    }
+
+    void activateNextNodes(int chosenIndex) {
+        ALLOC_ZONE("Map::activateNextNodes");
+        if (currentNode >= 0 && currentNode < nodes.size()) {
+            nodes[currentNode].visited = true;
+        }
+
+        for (auto& node : nodes) {
+            node.active = false;
+        }
+
+        currentNode = chosenIndex;
+        currentOptions.clear();
+        mapLayer.invalidate();
+
+        int options[2];
+        int optionCount = MapGraph::next(chosenIndex, options);
+        for (int i = 0; i < optionCount; i++) {
+            nodes[options[i]].active = true;
+            currentOptions.push_back(options[i]);
+        }
+        updateNodeText(optionCount);
+    }
+
+    // " (62% run win, ~40 HP, +55 coins)"
+    static string adviceText(const RouteAdvisor::Estimate& estimate) {
+        char text[64];
+        snprintf(text, sizeof(text), " (%d%% run win, ~%d HP, %+d coins)", (int)(estimate.winChance * 100.f + 0.5f),
+            (int)(estimate.endHP + 0.5f), (int)(estimate.coins + 0.5f));
+        return text;
+    }
+
+    void updateNodeText(int optionsCount) {
+        ALLOC_ZONE("Map::updateNodeText");
+        RouteAdvisor::Estimate estimates[2];
+        int advised = RouteAdvisor::instance().advise(currentNode, player.getHP(), player.getMaxHP(), estimates);
+        int previous = advisedOption;
+        advisedOption = optionsCount == 2 ? advised : -1;
+        if (advisedOption != previous) mapLayer.invalidate();
+
+        if (optionsCount == 1) {
+            string state;
+            switch (nodes[currentOptions[0]].type) {
+            case 0: state = "Battle"; break;
+            case 1: state = "Shop"; break;
+            case 2: state = "Refill Health"; break;
+            }
+            nodeInfoText.setString("Press ENTER to enter " + state + adviceText(estimates[0]));
+        }
+        else if (optionsCount == 2) {
+            string state1, state2;
+            switch (nodes[currentOptions[0]].type) {
+            case 0: state1 = "Battle"; break;
+            case 1: state1 = "Shop"; break;
+            case 2: state1 = "Refill Health"; break;
+            }
+            switch (nodes[currentOptions[1]].type) {
+            case 0: state2 = "Battle"; break;
+            case 1: state2 = "Shop"; break;
+            case 2: state2 = "Refill Health"; break;
+            }
+            nodeInfoText.setString("Press 1 for " + state1 + adviceText(estimates[0]) + (advised == 0 ? " - advised" : "") +
+                "\nPress 2 for " + state2 + adviceText(estimates[1]) + (advised == 1 ? " - advised" : ""));
+        }
+    }
+
+    // Battles and shops are pushed on top of the map; resume() picks up the result.
+    void selectOption(int optionIndex) {
+        if (optionIndex < 0 || optionIndex >= currentOptions.size()) return;
+
+        int nodeIndex = currentOptions[optionIndex];
+        if (!nodes[nodeIndex].active) return;
+
+        switch (nodes[nodeIndex].type) {
+        case 0:
+            enteredNode = nodeIndex;
+            battleStartHP = player.getHP();
+            battle.begin(currentNode);
+            stack->push(battle);
+            break;
+        case 1:
+            enteredNode = nodeIndex;
+            shop.begin();
+            stack->push(shop);
+            break;
+        case 2:
+            player.heal(player.getMaxHP() - player.getHP());
+            completeNode(nodeIndex);
+            break;
+        }
+    }
+
+    void completeNode(int nodeIndex) {
+        activateNextNodes(nodeIndex);
+        updateHealthDisplay();
+        if (currentNode == MapGraph::FINAL_NODE && currentOptions.size() == 0) {
+            finish(VICTORY); // Blue node battle won, no more options
+        }
+    }
+
+    void resume(Scene& finishedScene, int finishedResult) override {
+        int nodeIndex = enteredNode;
+        enteredNode = -1;
+        if (nodeIndex < 0) return;
+
+        if (&finishedScene == &battle) {
+            RouteAdvisor::instance().recordBattle(currentNode, battleStartHP - player.getHP());
+        }
+        if (&finishedScene == &battle && finishedResult != Battle::WON) {
+            updateHealthDisplay();
+            if (!player.isAlive()) finish(DEFEAT);
+            return;
         }
+        completeNode(nodeIndex);
     }
 
-    void playSelectedCard(int targetEnemy) {
-        if (selectedCard == -1 || player.getCurrentMana() < 1) return;
-
-        if (hand[selectedCard]->getID() == 1) { // Heal card
-            hand[selectedCard]->play(&player, enemies, enemyCount);
+    void handleInput(const InputSystem::Input& input) override {
+        if (input.action == InputSystem::CONFIRM && currentOptions.size() == 1) {
+            selectOption(0);
         }
-        else if (targetEnemy >= 0) {
-            hand[selectedCard]->play(&player, &enemies[targetEnemy], 1);
+        else if (input.action == InputSystem::SELECT && input.slot < (int)currentOptions.size()) {
+            selectOption(input.slot);
         }
-
-        player.spendMana(1);
-        deck.discard(hand[selectedCard]); // Return to discard pile
-        hand[selectedCard] = nullptr;
-        cardsInHand--;
-
-        selectedCard = -1;
-        currentState = SELECT_CARD;
-        updateActionText();
     }
 
-    void endPlayerTurn() {
-        playerTurn = false;
-        updateTurnText();
+    void tick(float dt) override {
+        background.update(view);
     }
 
-    void updateBattleState(float dt) {
-        hpText.setString("HP: " + to_string(player.getHP()) + "/" + to_string(player.getMaxHP()));
-        manaText.setString("Mana: " + to_string(player.getCurrentMana()) + "/" + to_string(player.getMaxMana()));
+    const char* sceneName() const override { return "Map"; }
 
-        player.updateSprite(dt);
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i]) {
-                enemies[i]->updateSprite(dt);
-            }
-        }
+    // HP may have changed since the map was last on screen (a restart heals).
+    bool prepare() override {
+        updateHealthDisplay();
+        background.update(view);
+        return true;
+    }
 
-        if (!playerTurn && currentState != PROCESSING) {
-            currentState = PROCESSING;
-            updateActionText();
-            updateTurnText();
+    void buildFrame(RenderSnapshot& frame) override {
+        frame.clear();
+        background.draw(frame, view); // Changes as tiles arrive, so it stays out of the layer
 
-            for (int i = 0; i < enemyCount; i++) {
-                if (enemies[i] && enemies[i]->isAlive()) {
-                    enemies[i]->attack(player);
-                    window.display();
-                    sleep(milliseconds(300));
+        if (mapLayer.isDirty()) {
+            RenderSnapshot& layer = mapLayer.rebuild();
+
+            for (auto& node : nodes) {
+                if (node.visited) {
+                    node.sprite.setColor(VISITED_COLOR);
+                }
+                else if (advisedOption >= 0 && &node == &nodes[currentOptions[advisedOption]]) {
+                    node.sprite.setColor(ADVISED_COLOR);
+                }
+                else if (node.active) {
+                    node.sprite.setColor(ACTIVE_COLOR);
                 }
+                else {
+                    node.sprite.setColor(INACTIVE_COLOR);
+                }
+                layer.draw(node.sprite);
             }
 
-            playerTurn = true;
-            player.resetMana();
-            MagickaCard::reset();
-            fillHand();
-            currentState = SELECT_CARD;
-            updateTurnText();
-            updateActionText();
+            layer.draw(headerText, 0.5f);
+            layer.draw(healthBox);
+            HudFont::Line(layer, 24, Vector2f(1070, 650), healthColor)
+                .word(HudFont::HP).number(player.getHP()).character('/').number(player.getMaxHP());
+            layer.draw(nodeInfoText);
         }
+        frame.draw(mapLayer);
     }
 
-    bool checkBattleEnd() {
-        bool allEnemiesDead = true;
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i] && enemies[i]->isAlive()) {
-                allEnemiesDead = false;
-                break;
-            }
+public:
+    Map(Player& p, Battle& b, Shop& s) : player(p), battle(b), shop(s), currentNode(-1), enteredNode(-1),
+        battleStartHP(0), advisedOption(-1), background("Images/Map/map_bg.png", Color(38, 46, 36)) {
+        if (!TextureLoader::tryLoadFont(font, "Fonts/American Captain.ttf")) {
+            LOG_ERROR(Log::Assets, "Critical: No fonts available!");
         }
 
-        if (allEnemiesDead) {
-            awardCoins();
-            battleOver = true;
-            playerWon = true;
-            return true;
-        }
+        TextureCache& textures = TextureCache::instance();
+        textures.load(TextureCache::Batch()
+            .add("Images/Map/iconbat.png", TextureCache::MAP)
+            .add("Images/Map/iconshop.png", TextureCache::MAP)
+            .add("Images/Map/health_refill.png", TextureCache::MAP));
+        nodeTextures[0] = &textures.get("Images/Map/iconbat.png", TextureCache::MAP);
+        nodeTextures[1] = &textures.get("Images/Map/iconshop.png", TextureCache::MAP);
+        nodeTextures[2] = &textures.get("Images/Map/health_refill.png", TextureCache::MAP);
+        currentOptions.reserve(2);
 
-        if (!player.isAlive()) {
-            battleOver = true;
-            playerWon = false;
-            return true;
+        setupNodes();
+        setupUI();
+        activateNextNodes(-1);
+    }
+
+    // Back to the first node for a new run.
+    void reset() {
+        for (auto& node : nodes) {
+            node.visited = false;
         }
+        currentNode = -1;
+        enteredNode = -1;
+        activateNextNodes(-1);
+        updateHealthDisplay();
+    }
+};
 
-        return false;
+// Merging t-digest (Dunning) for continuous values. Samples collect in a
+// buffer and are folded into at most about 2x COMPRESSION centroids, which
+// keeps tails accurate in constant memory.
+class TDigest {
+private:
+    static const int COMPRESSION = 100;
+    static const int MAX_CENTROIDS = 2 * COMPRESSION;
+    static const int BUFFER_SIZE = 512;
+
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+
+    Centroid centroids[MAX_CENTROIDS];
+    Centroid buffer[BUFFER_SIZE];
+    Centroid scratch[MAX_CENTROIDS + BUFFER_SIZE];
+    int centroidCount;
+    int bufferCount;
+    double totalWeight;
+    double lowest;
+    double highest;
+
+    // k1 scale function: centroids are small near the tails
+    static double scale(double q) {
+        return COMPRESSION / (2.0 * 3.14159265358979) * asin(2.0 * q - 1.0);
     }
 
-    void render() {
-        window.clear();
-        window.draw(background);
+    static double inverseScale(double k) {
+        return (sin(k * 2.0 * 3.14159265358979 / COMPRESSION) + 1.0) / 2.0;
+    }
 
-        // Draw enemies
-        for (int i = 0; i < enemyCount; i++) {
-            if (enemies[i]) {
-                window.draw(enemies[i]->getSprite());
+    void compress() {
+        if (bufferCount == 0) return;
+
+        int count = 0;
+        for (int i = 0; i < centroidCount; i++) scratch[count++] = centroids[i];
+        for (int i = 0; i < bufferCount; i++) scratch[count++] = buffer[i];
+        bufferCount = 0;
+        sort(scratch, scratch + count, [](const Centroid& a, const Centroid& b) { return a.mean < b.mean; });
+
+        double total = 0.0;
+        for (int i = 0; i < count; i++) total += scratch[i].weight;
+        totalWeight = total;
+
+        centroidCount = 0;
+        Centroid current = scratch[0];
+        double weightBefore = 0.0;
+        double limit = total * inverseScale(scale(0.0) + 1.0);
+        for (int i = 1; i < count; i++) {
+            if (weightBefore + current.weight + scratch[i].weight <= limit) {
+                current.mean += (scratch[i].mean - current.mean) * scratch[i].weight / (current.weight + scratch[i].weight);
+                current.weight += scratch[i].weight;
+            }
+            else {
+                weightBefore += current.weight;
+                centroids[centroidCount++] = current;
+                current = scratch[i];
+                limit = total * inverseScale(min(scale(1.0), scale(weightBefore / total) + 1.0));
             }
         }
+        centroids[centroidCount++] = current;
+    }
 
-        // Draw player
-        window.draw(player.getSprite());
+    void add(double value, double weight) {
+        if (bufferCount == BUFFER_SIZE) compress();
+        buffer[bufferCount].mean = value;
+        buffer[bufferCount].weight = weight;
+        bufferCount++;
+        totalWeight += weight;
+    }
 
-        // Draw cards
-        for (int i = 0; i < 4; i++) {
-            if (hand[i]) {
-                // Position cards vertically
-                hand[i]->getSprite().setPosition(CARD_POSITIONS[i]);
-                hand[i]->getSprite().setRotation(0);
-                window.draw(hand[i]->getSprite());
+public:
+    TDigest() : centroidCount(0), bufferCount(0), totalWeight(0.0), lowest(0.0), highest(0.0) {}
+
+    void record(double value) {
+        if (totalWeight == 0.0) lowest = highest = value;
+        lowest = min(lowest, value);
+        highest = max(highest, value);
+        add(value, 1.0);
+    }
+
+    void merge(TDigest& other) {
+        other.compress();
+        if (other.totalWeight == 0.0) return;
+        if (totalWeight == 0.0) {
+            lowest = other.lowest;
+            highest = other.highest;
+        }
+        lowest = min(lowest, other.lowest);
+        highest = max(highest, other.highest);
+        for (int i = 0; i < other.centroidCount; i++) {
+            add(other.centroids[i].mean, other.centroids[i].weight);
+        }
+    }
+
+    double count() const { return totalWeight; }
+
+    double quantile(double q) {
+        compress();
+        if (centroidCount == 0) return 0.0;
+        if (centroidCount == 1) return centroids[0].mean;
+
+        // Interpolate between centroid centres, anchored at the exact min and max.
+        double rank = q * totalWeight;
+        double seen = 0.0;
+        for (int i = 0; i < centroidCount; i++) {
+            double centre = seen + centroids[i].weight / 2.0;
+            if (rank < centre) {
+                if (i == 0) {
+                    return lowest + (centroids[0].mean - lowest) * (rank / centre);
+                }
+                double previousCentre = seen - centroids[i - 1].weight / 2.0;
+                double t = (rank - previousCentre) / (centre - previousCentre);
+                return centroids[i - 1].mean + (centroids[i].mean - centroids[i - 1].mean) * t;
             }
+            seen += centroids[i].weight;
         }
+        double lastCentre = totalWeight - centroids[centroidCount - 1].weight / 2.0;
+        double t = (rank - lastCentre) / (totalWeight - lastCentre);
+        return centroids[centroidCount - 1].mean + (highest - centroids[centroidCount - 1].mean) * min(1.0, t);
+    }
+};
 
-        // Draw UI
-        window.draw(hpBox);
-        window.draw(manaBox);
-        window.draw(hpText);
-        window.draw(manaText);
-        window.draw(actionText);
-        window.draw(turnText);
+// Raw samples as one file of native-endian int32 per column and writer thread:
+// <dir>/<table>.<column>.<thread>.i32. Each column buffers a few KB, so memory
+// doesn't grow with the number of rows.
+class SampleTable {
+private:
+    static const int BUFFER_ROWS = 2048;
+
+    struct Column {
+        FILE* file;
+        Int32 buffer[BUFFER_ROWS];
+    };
 
-        window.display();
+    vector<Column*> columns;
+    int buffered;
+    Uint64 rows;
+
+    void flush() {
+        for (Column* column : columns) {
+            if (column->file && buffered) fwrite(column->buffer, sizeof(Int32), buffered, column->file);
+        }
+        buffered = 0;
     }
 
 public:
-    Battle(Player& p, Deck& d, int n, RenderWindow& w) :
-        player(p), deck(d), node(n), window(w),
-        playerTurn(true), battleOver(false), playerWon(false),
-        cardsInHand(0), selectedCard(-1), selectedEnemy(-1),
-        currentState(SELECT_CARD) {
+    SampleTable(const string& directory, const string& table, const vector<string>& names, int thread) : buffered(0), rows(0) {
+        for (const string& name : names) {
+            Column* column = new Column();
+            string path = directory + "/" + table + "." + name + "." + to_string(thread) + ".i32";
+            column->file = fopen(path.c_str(), "wb");
+            if (!column->file) LOG_ERROR(Log::Game, "Cannot write samples to %s", path.c_str());
+            columns.push_back(column);
+        }
+    }
 
-        for (int i = 0; i < 4; i++) {
-            enemies[i] = nullptr;
-            hand[i] = nullptr;
+    SampleTable(const SampleTable&) = delete;
+    SampleTable& operator=(const SampleTable&) = delete;
+
+    ~SampleTable() {
+        flush();
+        for (Column* column : columns) {
+            if (column->file) fclose(column->file);
+            delete column;
         }
+    }
 
-        if (!bgTexture.loadFromFile("battle.png") || !font.loadFromFile("Fonts/American Captain.ttf")) {
-            cerr << "Failed to load battle resources!" << endl;
-            return;
+    void row(const Int32* values) {
+        for (size_t i = 0; i < columns.size(); i++) {
+            columns[i]->buffer[buffered] = values[i];
         }
-        background.setTexture(bgTexture);
+        rows++;
+        if (++buffered == BUFFER_ROWS) flush();
+    }
 
-        setupEnemies();
-        setupUI();
-        fillHand();
+    Uint64 getRows() const { return rows; }
+};
+
+// Aggregates for one simulation thread. Threads never share these; they are
+// merged once the workers have finished.
+struct SimStats {
+    Uint64 runs;
+    Uint64 wins;
+    Uint64 losses;
+    Uint64 timeouts;
+    Uint64 battles;
+    Uint64 damageTaken; // Player HP lost over all battles
+    Uint64 cardPlays[CardLibrary::MAX_DEFINITIONS];
+    Uint64 cardDamage[CardLibrary::MAX_DEFINITIONS];
+
+    HdrHistogram hpAfterBattle;
+    HdrHistogram coinsAtShop;
+    HdrHistogram turnsPerBattle;
+    HdrHistogram damagePerPlay;
+    HdrHistogram nodesCleared;
+    TDigest decisionMicros;
+
+    SimStats() : runs(0), wins(0), losses(0), timeouts(0), battles(0), damageTaken(0) {
+        memset(cardPlays, 0, sizeof(cardPlays));
+        memset(cardDamage, 0, sizeof(cardDamage));
     }
 
-    ~Battle() {
-        cleanup();
+    void merge(SimStats& other) {
+        runs += other.runs;
+        wins += other.wins;
+        losses += other.losses;
+        timeouts += other.timeouts;
+        battles += other.battles;
+        damageTaken += other.damageTaken;
+        for (int i = 0; i < CardLibrary::MAX_DEFINITIONS; i++) {
+            cardPlays[i] += other.cardPlays[i];
+            cardDamage[i] += other.cardDamage[i];
+        }
+        hpAfterBattle.merge(other.hpAfterBattle);
+        coinsAtShop.merge(other.coinsAtShop);
+        turnsPerBattle.merge(other.turnsPerBattle);
+        damagePerPlay.merge(other.damagePerPlay);
+        nodesCleared.merge(other.nodesCleared);
+        decisionMicros.merge(other.decisionMicros);
     }
+};
 
-    bool run() {
-        while (window.isOpen() && !battleOver) {
-            Time deltaTime = deltaClock.restart();
+// Headless runs through the map: battles on BattleState played by TurnSolver,
+// fixed route and shop policies, no window or textures. Runs are spread over
+// worker threads, each seeded from its run index, so results don't depend on
+// the thread count.
+class RunSimulator {
+public:
+    struct Options {
+        int runs;
+        int threads;
+        Uint64 seed;
+        TurnSolver::Mode policy;
+        string samplesDirectory; // Empty for aggregates only
+        Uint64 dailySeed; // Non-zero fixes each node's enemies, as in a daily challenge
+    };
 
-            Event event;
-            while (window.pollEvent(event)) {
-                if (event.type == Event::Closed) {
-                    window.close();
-                    return false;
-                }
+private:
+    static const int MAX_TURNS = 50; // A battle still going after this counts as a loss
 
-                if (event.type == Event::KeyPressed && playerTurn) {
-                    if (event.key.code == Keyboard::Enter) {
-                        endPlayerTurn();
-                    }
-                    else if (currentState == SELECT_CARD) {
-                        if (event.key.code >= Keyboard::Num1 && event.key.code <= Keyboard::Num4) {
-                            handleCardSelection(event.key.code - Keyboard::Num1 + 1);
-                        }
-                    }
-                    else if (currentState == SELECT_ENEMY) {
-                        if (event.key.code >= Keyboard::Num1 && event.key.code <= Keyboard::Num4) {
-                            handleEnemySelection(event.key.code - Keyboard::Num1 + 1);
-                        }
-                        else if (event.key.code == Keyboard::Escape) {
-                            currentState = SELECT_CARD;
-                            selectedCard = -1;
-                            updateActionText();
-                        }
-                    }
-                }
+    struct Run {
+        int hp;
+        int maxHP;
+        int maxMana;
+        int coins;
+    };
+
+    struct Worker {
+        SimStats stats;
+        TurnSolver solver;
+        SampleTable* battles;
+        SampleTable* plays;
+        Worker() : battles(nullptr), plays(nullptr) {}
+    };
+
+    static bool simulateBattle(int runIndex, int node, Run& run, Deck& deck, Worker& worker, const Options& options) {
+        const CardLibrary& library = CardLibrary::instance();
+        Random& random = Random::local();
+
+        BattleState state = BattleState();
+        state.playerHP = run.hp;
+        state.playerMaxHP = run.maxHP;
+        if (options.dailySeed) {
+            Random encounters = DailyChallenge::encounters(options.dailySeed, node);
+            state.spawnEnemies(node, encounters);
+        }
+        else {
+            state.spawnEnemies(node, random);
+        }
+        int startHP = run.hp;
+
+        int hand[TurnSolver::HAND_SIZE] = { -1, -1, -1, -1 };
+        int turn = 0;
+        bool won = false;
+        while (turn < MAX_TURNS) {
+            turn++;
+            if (turn > 1) state.tickStatuses();
+            for (int i = 0; i < TurnSolver::HAND_SIZE; i++) {
+                if (hand[i] >= 0) deck.discard(hand[i]);
+                hand[i] = deck.draw();
             }
 
-            updateBattleState(deltaTime.asSeconds());
+            int mana = run.maxMana;
+            TurnSolver::Line line = worker.solver.solve(state, hand, deck, mana, options.policy);
+            worker.stats.decisionMicros.record(worker.solver.getLastMicros());
+
+            for (int step = 0; step < line.plays; step++) {
+                int slot = line.slot[step];
+                int id = hand[slot];
+                int before = 0, after = 0;
+                for (int i = 0; i < state.enemyCount; i++) before += max(0, state.enemyHP[i]);
+                library.play(id, deck.getLevel(id), state, line.target[step]);
+                for (int i = 0; i < state.enemyCount; i++) after += max(0, state.enemyHP[i]);
+
+                worker.stats.cardPlays[id]++;
+                worker.stats.cardDamage[id] += before - after;
+                worker.stats.damagePerPlay.record(before - after);
+                if (worker.plays) {
+                    Int32 values[5] = { runIndex, node, turn, id, before - after };
+                    worker.plays->row(values);
+                }
+                mana -= library.get(id).cost;
+                deck.discard(id);
+                hand[slot] = -1;
+            }
 
-            if (checkBattleEnd()) {
+            if (state.firstAliveEnemy() < 0) {
+                won = true;
                 break;
             }
 
-            render();
+            for (int i = 0; i < state.enemyCount && state.playerHP > 0; i++) {
+                if (state.enemyAlive[i]) state.playerHP -= state.enemyDamage(i, BattleState::rollAttack(state.enemyType[i], random));
+            }
+            if (state.playerHP <= 0) break;
         }
 
-        return playerWon;
-    }
-};
-class Shop {
-private:
-    Texture crossTexture;
-    Sprite crossSprite;
-    Texture cardTextures[5]; // 0=Slash, 1=Heal, 2=Inquisition, 3=Drain, 4=Magicka
-    Texture upgradeTextures[3]; // 0=RefillHP, 1=IncreaseHP, 2=IncreaseMana
-    Sprite cardSprites[5];
-    Sprite upgradeSprites[3];
-    Font font;
-    Text priceTexts[8]; // 5 cards + 3 upgrades
-    Text selectionTexts[8]; // Numbers for selection
-    Text coinText;
-    int prices[5] = { 50, 50, 100, 100, 200 }; // Card upgrade/unlock prices
-    int upgradePrices[3] = { 20, 50, 50 }; // RefillHP, IncreaseHP, IncreaseMana prices
-    bool unlocked[5] = { true, true, false, false, false }; // Slash/Heal start unlocked
+        for (int i = 0; i < TurnSolver::HAND_SIZE; i++) {
+            if (hand[i] >= 0) deck.discard(hand[i]);
+        }
 
-    // Card positions
-    const Vector2f CARD_POSITIONS[5] = {
-        Vector2f(200, 150),  // Slash (1)
-        Vector2f(400, 150),  // Heal (2)
-        Vector2f(600, 150),  // Inquisition (3)
-        Vector2f(200, 350),  // Drain (4)
-        Vector2f(400, 350)   // Magicka (5)
-    };
+        run.hp = max(0, state.playerHP);
+        if (won) {
+            for (int i = 0; i < state.enemyCount; i++) run.coins += BattleState::coinReward(state.enemyType[i]);
+            run.coins += BattleState::VICTORY_COINS;
+        }
+        else if (state.playerHP > 0) {
+            worker.stats.timeouts++;
+        }
 
-    // Upgrade positions
-    const Vector2f UPGRADE_POSITIONS[3] = {
-        Vector2f(600, 350),  // Refill HP (6)
-        Vector2f(800, 150),  // Increase HP (7)
-        Vector2f(800, 350)   // Increase Mana (8)
-    };
+        worker.stats.battles++;
+        worker.stats.damageTaken += (Uint64)max(0, startHP - run.hp);
+        worker.stats.hpAfterBattle.record(run.hp);
+        worker.stats.turnsPerBattle.record(turn);
+        if (worker.battles) {
+            Int32 values[5] = { runIndex, node, turn, run.hp, won ? 1 : 0 };
+            worker.battles->row(values);
+        }
+        return won;
+    }
 
-public:
-    Shop() {
-        // Load textures
-        if (!crossTexture.loadFromFile("cross.png")) {
-            cerr << "Failed to load cross texture!" << endl;
+    // Refill when below half HP, then keep buying the cheapest card unlock or upgrade.
+    static void visitShop(Run& run, Deck& deck, Worker& worker) {
+        worker.stats.coinsAtShop.record(run.coins);
+        const CardLibrary& library = CardLibrary::instance();
+
+        if (run.hp < run.maxHP / 2 && run.coins >= Shop::REFILL_PRICE) {
+            run.coins -= Shop::REFILL_PRICE;
+            run.hp = run.maxHP;
         }
-        crossSprite.setTexture(crossTexture);
-        crossSprite.setPosition(1200, 20);
 
-        // Load card textures
-        string cardFiles[5] = { "slash.png", "heal.png", "inquisition.png", "drain.png", "MAGICKA.png" };
-        for (int i = 0; i < 5; i++) {
-            if (!cardTextures[i].loadFromFile(cardFiles[i])) {
-                cerr << "Failed to load card texture: " << cardFiles[i] << endl;
+        while (true) {
+            int cheapest = -1;
+            for (int id = 0; id < library.count(); id++) {
+                if (deck.owns(id) && !library.get(id).upgradable) continue;
+                if (deck.getPrice(id) > run.coins) continue;
+                if (cheapest < 0 || deck.getPrice(id) < deck.getPrice(cheapest)) cheapest = id;
             }
-            cardSprites[i].setTexture(cardTextures[i]);
-            cardSprites[i].setPosition(CARD_POSITIONS[i]);
-            cardSprites[i].setScale(0.1f, 0.1f); // Smaller card size
-        }
+            if (cheapest < 0) break;
 
-        // Load upgrade textures (made smaller)
-        string upgradeFiles[3] = { "rhp.png", "ihp.png", "im.png" };
-        for (int i = 0; i < 3; i++) {
-            if (!upgradeTextures[i].loadFromFile(upgradeFiles[i])) {
-                cerr << "Failed to load upgrade texture: " << upgradeFiles[i] << endl;
+            run.coins -= deck.getPrice(cheapest);
+            if (deck.owns(cheapest)) {
+                deck.upgrade(cheapest);
+            }
+            else {
+                for (int i = 0; i < library.get(cheapest).unlockCopies; i++) deck.addCard(cheapest);
             }
-            upgradeSprites[i].setTexture(upgradeTextures[i]);
-            upgradeSprites[i].setPosition(UPGRADE_POSITIONS[i]);
-            upgradeSprites[i].setScale(0.2f, 0.2f);
         }
+    }
 
-        // Load font
-        if (!font.loadFromFile("Fonts/American Captain.ttf")) {
-            cerr << "Failed to load font!" << endl;
+    // Route: refill when hurt, shop with 100+ coins, otherwise fight.
+    static int chooseNode(const int options[2], int count, const Run& run) {
+        for (int i = 0; i < count; i++) {
+            if (MapGraph::type(options[i]) == MapGraph::REFILL && run.hp * 10 < run.maxHP * 6) return options[i];
+        }
+        for (int i = 0; i < count; i++) {
+            if (MapGraph::type(options[i]) == MapGraph::SHOP && run.coins >= 100) return options[i];
+        }
+        for (int i = 0; i < count; i++) {
+            if (MapGraph::type(options[i]) == MapGraph::BATTLE) return options[i];
+        }
+        return options[0];
+    }
+
+    static void simulateRun(int runIndex, Worker& worker, const Options& options) {
+        Random::local().reseed(options.seed + (Uint64)runIndex);
+        Run run = { 25, 25, 5, 100 }; // Same as a new Player
+        Deck deck(Random::local());
+
+        int node = -1;
+        int cleared = 0;
+        bool alive = true;
+        while (alive) {
+            int choices[2];
+            int count = MapGraph::next(node, choices);
+            if (count == 0) break;
+
+            int chosen = chooseNode(choices, count, run);
+            switch (MapGraph::type(chosen)) {
+            case MapGraph::BATTLE: alive = simulateBattle(runIndex, node, run, deck, worker, options); break;
+            case MapGraph::SHOP: visitShop(run, deck, worker); break;
+            case MapGraph::REFILL: run.hp = run.maxHP; break;
+            }
+            if (alive) {
+                node = chosen;
+                cleared++;
+            }
         }
 
-        // Setup price and selection texts
-        for (int i = 0; i < 8; i++) {
-            priceTexts[i].setFont(font);
-            priceTexts[i].setCharacterSize(18); // Slightly smaller text
-            priceTexts[i].setFillColor(Color::White);
+        worker.stats.runs++;
+        worker.stats.nodesCleared.record(cleared);
+        if (alive) worker.stats.wins++;
+        else worker.stats.losses++;
+    }
 
-            selectionTexts[i].setFont(font);
-            selectionTexts[i].setCharacterSize(24);
-            selectionTexts[i].setFillColor(Color::Yellow);
-            selectionTexts[i].setString("[" + to_string(i + 1) + "]");
+    static void report(SimStats& stats, double seconds) {
+        LOG_INFO(Log::Game, "Simulated %llu runs in %.2f s (%.0f runs/s)", (unsigned long long)stats.runs, seconds, stats.runs / max(seconds, 1e-9));
+        LOG_INFO(Log::Game, "  wins %llu, losses %llu (%llu battles timed out)", (unsigned long long)stats.wins,
+            (unsigned long long)stats.losses, (unsigned long long)stats.timeouts);
+        LOG_INFO(Log::Game, "  nodes cleared: mean %.2f, p50 %llu", stats.nodesCleared.mean(), (unsigned long long)stats.nodesCleared.quantile(0.5));
+        LOG_INFO(Log::Game, "  turns per battle: mean %.2f, p50 %llu, p99 %llu, max %llu", stats.turnsPerBattle.mean(),
+            (unsigned long long)stats.turnsPerBattle.quantile(0.5), (unsigned long long)stats.turnsPerBattle.quantile(0.99),
+            (unsigned long long)stats.turnsPerBattle.maximum());
+        LOG_INFO(Log::Game, "  HP after battle: p10 %llu, p50 %llu, p90 %llu", (unsigned long long)stats.hpAfterBattle.quantile(0.1),
+            (unsigned long long)stats.hpAfterBattle.quantile(0.5), (unsigned long long)stats.hpAfterBattle.quantile(0.9));
+        LOG_INFO(Log::Game, "  coins entering shop: p10 %llu, p50 %llu, p90 %llu", (unsigned long long)stats.coinsAtShop.quantile(0.1),
+            (unsigned long long)stats.coinsAtShop.quantile(0.5), (unsigned long long)stats.coinsAtShop.quantile(0.9));
+        LOG_INFO(Log::Game, "  decision time: p50 %.1f us, p99 %.1f us, p99.9 %.1f us", stats.decisionMicros.quantile(0.5),
+            stats.decisionMicros.quantile(0.99), stats.decisionMicros.quantile(0.999));
+
+        const CardLibrary& library = CardLibrary::instance();
+        for (int id = 0; id < library.count(); id++) {
+            if (!stats.cardPlays[id]) continue;
+            LOG_INFO(Log::Game, "  %-12s %10llu plays, %6.2f damage per play", library.get(id).name.c_str(),
+                (unsigned long long)stats.cardPlays[id], (double)stats.cardDamage[id] / stats.cardPlays[id]);
         }
+    }
 
-        // Position price texts further below cards/upgrades
-        for (int i = 0; i < 5; i++) {
-            priceTexts[i].setPosition(CARD_POSITIONS[i].x, CARD_POSITIONS[i].y + 60); // Pushed down
-            selectionTexts[i].setPosition(CARD_POSITIONS[i].x - 30, CARD_POSITIONS[i].y);
+    static void writeSchema(const Options& options, const vector<Worker*>& workers) {
+        string path = options.samplesDirectory + "/schema.txt";
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file) {
+            LOG_ERROR(Log::Game, "Cannot write %s", path.c_str());
+            return;
         }
-        for (int i = 0; i < 3; i++) {
-            priceTexts[i + 5].setPosition(UPGRADE_POSITIONS[i].x, UPGRADE_POSITIONS[i].y + 120); // Pushed down
-            selectionTexts[i + 5].setPosition(UPGRADE_POSITIONS[i].x - 30, UPGRADE_POSITIONS[i].y);
+        Uint64 battleRows = 0, playRows = 0;
+        for (Worker* worker : workers) {
+            battleRows += worker->battles->getRows();
+            playRows += worker->plays->getRows();
         }
-
-        // Setup coin display in bottom right
-        coinText.setFont(font);
-        coinText.setCharacterSize(30);
-        coinText.setFillColor(Color::Yellow);
-        coinText.setPosition(1000, 650); // Bottom right position
+        fprintf(file, "# One file per column and thread: <table>.<column>.<thread>.i32, native-endian int32\n");
+        fprintf(file, "threads %d\n", (int)workers.size());
+        fprintf(file, "table battles rows %llu columns run node turns hp won\n", (unsigned long long)battleRows);
+        fprintf(file, "table plays rows %llu columns run node turn card damage\n", (unsigned long long)playRows);
+        for (int id = 0; id < CardLibrary::instance().count(); id++) {
+            fprintf(file, "card %d %s\n", id, CardLibrary::instance().get(id).name.c_str());
+        }
+        fclose(file);
     }
 
-    bool run(Player& player, Deck& deck, RenderWindow& window) {
-        // Instruction text
-        Text instructions;
-        instructions.setFont(font);
-        instructions.setCharacterSize(24);
-        instructions.setFillColor(Color::White);
-        instructions.setString("Press 1-8 to select, ESCAPE to exit");
-        instructions.setPosition(50, 600);
+public:
+    // Plays every run and merges the workers' statistics into `total`; returns the wall time in seconds.
+    static double simulate(const Options& options, SimStats& total) {
+        int threadCount = max(1, options.threads);
+        static const vector<string> battleColumns = { "run", "node", "turns", "hp", "won" };
+        static const vector<string> playColumns = { "run", "node", "turn", "card", "damage" };
+        vector<Worker*> workers;
+        for (int i = 0; i < threadCount; i++) {
+            Worker* worker = new Worker();
+            if (!options.samplesDirectory.empty()) {
+                worker->battles = new SampleTable(options.samplesDirectory, "battles", battleColumns, i);
+                worker->plays = new SampleTable(options.samplesDirectory, "plays", playColumns, i);
+            }
+            workers.push_back(worker);
+        }
 
-        while (window.isOpen()) {
-            Event event;
-            while (window.pollEvent(event)) {
-                if (event.type == Event::Closed) {
-                    window.close();
-                    return false;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        atomic<int> nextRun(0);
+        vector<thread> threads;
+        for (int i = 0; i < threadCount; i++) {
+            threads.push_back(thread([&options, &nextRun, worker = workers[i]]() {
+                int runIndex;
+                while ((runIndex = nextRun.fetch_add(1, memory_order_relaxed)) < options.runs) {
+                    simulateRun(runIndex, *worker, options);
                 }
+            }));
+        }
+        for (thread& worker : threads) {
+            worker.join();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-                if (event.type == Event::KeyPressed) {
-                    if (event.key.code == Keyboard::Escape) {
-                        return true; // Exit shop
-                    }
+        for (Worker* worker : workers) {
+            total.merge(worker->stats);
+        }
 
-                    // Handle number key presses
-                    if (event.key.code >= Keyboard::Num1 && event.key.code <= Keyboard::Num8) {
-                        int selection = event.key.code - Keyboard::Num1; // 0-7
-
-                        if (selection < 5) { // Card selection
-                            if (player.getCoins() >= prices[selection]) {
-                                player.buy(prices[selection]);
-                                if (selection < 2 || unlocked[selection]) { // Upgrade
-                                    switch (selection) {
-                                    case 0: SlashCard::upgrade(); break;
-                                    case 1: HealCard::upgrade(); break;
-                                    case 2: Inquisition::upgrade(); break;
-                                    case 3: DrainCard::upgrade(); break;
-                                        // Magicka (4) is not upgradable
-                                    }
-                                    prices[selection] += 25;
-                                }
-                                else { // Unlock
-                                    unlocked[selection] = true;
-                                    int cardsToAdd = (selection == 4) ? 1 : 4;
-
-                                    for (int j = 0; j < cardsToAdd; j++) {
-                                        Card* newCard = nullptr;
-                                        switch (selection) {
-                                        case 2: newCard = new Inquisition(); break;
-                                        case 3: newCard = new DrainCard(); break;
-                                        case 4: newCard = new MagickaCard(); break;
-                                        }
-                                        if (newCard) deck.addCard(newCard);
-                                    }
-                                }
-                            }
-                        }
-                        else if (selection >= 5 && selection < 8) { // Upgrade selection
-                            int upgradeIndex = selection - 5;
-                            if (player.getCoins() >= upgradePrices[upgradeIndex]) {
-                                player.buy(upgradePrices[upgradeIndex]);
-                                switch (upgradeIndex) {
-                                case 0: // Refill HP
-                                    player.heal(player.getMaxHP() - player.getHP());
-                                    break;
-                                case 1: // Increase HP
-                                    player.setMaxHP(player.getMaxHP() + 5);
-                                    player.heal(5);
-                                    upgradePrices[upgradeIndex] += 20;
-                                    break;
-                                case 2: // Increase Mana
-                                    player.increaseMaxMana(1);
-                                    upgradePrices[upgradeIndex] += 25;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+        if (!options.samplesDirectory.empty()) writeSchema(options, workers);
+        for (Worker* worker : workers) {
+            delete worker->battles;
+            delete worker->plays;
+            delete worker;
+        }
+        return seconds;
+    }
 
-            // Update price texts
-            for (int i = 0; i < 5; i++) {
-                if (i < 2 || unlocked[i]) {
-                    priceTexts[i].setString("Upgrade: " + to_string(prices[i]) + " coins");
-                }
-                else {
-                    priceTexts[i].setString("Unlock: " + to_string(prices[i]) + " coins");
-                }
-                priceTexts[i].setFillColor(
-                    player.getCoins() >= prices[i] ? Color::White : Color::Red
-                );
-            }
+    static int run(const Options& options) {
+        LOG_INFO(Log::Game, "Simulating %d runs on %d threads (seed %llu, %s policy)", options.runs, max(1, options.threads),
+            (unsigned long long)options.seed, options.policy == TurnSolver::GREEDY ? "greedy" : "exact");
+        SimStats* total = new SimStats(); // About 60 KB of histograms; kept off the stack
+        double seconds = simulate(options, *total);
+        report(*total, seconds);
+        delete total;
+        return 0;
+    }
+};
 
-            // Update upgrade price texts
-            for (int i = 0; i < 3; i++) {
-                priceTexts[i + 5].setString(to_string(upgradePrices[i]) + " coins");
-                priceTexts[i + 5].setFillColor(
-                    player.getCoins() >= upgradePrices[i] ? Color::White : Color::Red
-                );
-            }
+// Screens daily challenge candidates before one is published. Each seed is
+// played for many runs by RunSimulator with the exact TurnSolver, spread over
+// all cores; the player's shuffles and attack rolls vary from run to run while
+// the seed's encounters stay fixed. A seed is winnable if any run wins; its
+// difficulty (loss rate, then HP lost per run) is ranked against the rest of
+// the batch, and seeds whose percentile falls inside the target band are picked.
+class SeedVerifier {
+public:
+    struct Options {
+        int date; // yyyymmdd
+        int candidates;
+        int runs; // Per seed
+        int threads;
+        float bandLow; // Percentiles, 0-100
+        float bandHigh;
+    };
 
-            // Update coin display
-            coinText.setString("Coins: " + to_string(player.getCoins()));
+    struct Verdict {
+        Uint64 seed;
+        double winRate;
+        double hpLost; // Per run
+        double seconds;
+        float percentile;
+    };
 
-            // Draw everything
-            window.clear(Color::Black);
+    static Verdict verify(Uint64 seed, int runs, int threads) {
+        RunSimulator::Options simulation = { runs, threads, seed, TurnSolver::EXACT, "", seed };
+        SimStats* stats = new SimStats();
+        Verdict verdict;
+        verdict.seed = seed;
+        verdict.seconds = RunSimulator::simulate(simulation, *stats);
+        verdict.winRate = stats->runs ? (double)stats->wins / stats->runs : 0.0;
+        verdict.hpLost = stats->runs ? (double)stats->damageTaken / stats->runs : 0.0;
+        verdict.percentile = 0.f;
+        delete stats;
+        return verdict;
+    }
 
-            // Draw cards
-            for (int i = 0; i < 5; i++) {
-                window.draw(cardSprites[i]);
-                window.draw(priceTexts[i]);
-                window.draw(selectionTexts[i]);
-            }
+    static bool harder(const Verdict& a, const Verdict& b) {
+        if (a.winRate != b.winRate) return a.winRate < b.winRate;
+        return a.hpLost > b.hpLost;
+    }
 
-            // Draw upgrades
-            for (int i = 0; i < 3; i++) {
-                window.draw(upgradeSprites[i]);
-                window.draw(priceTexts[i + 5]);
-                window.draw(selectionTexts[i + 5]);
-            }
+    // Returns 0 if at least one winnable seed landed in the band.
+    static int screen(const Options& options) {
+        int threadCount = max(1, options.threads);
+        LOG_INFO(Log::Game, "Screening %d daily seeds for %d: %d runs each on %d threads, band p%.0f-p%.0f", options.candidates,
+            options.date, options.runs, threadCount, options.bandLow, options.bandHigh);
 
-            // Draw UI elements
-            window.draw(crossSprite);
-            window.draw(coinText);
-            window.draw(instructions);
+        vector<Verdict> verdicts;
+        for (int i = 0; i < options.candidates; i++) {
+            verdicts.push_back(verify(DailyChallenge::seedFor(options.date, i), options.runs, threadCount));
+        }
 
-            window.display();
+        // Percentile: share of the batch that is easier than this seed.
+        int count = (int)verdicts.size();
+        for (Verdict& verdict : verdicts) {
+            int easier = 0;
+            for (const Verdict& other : verdicts) {
+                if (harder(verdict, other)) easier++;
+            }
+            verdict.percentile = count > 1 ? 100.f * easier / (count - 1) : 50.f;
         }
 
-        return false;
+        int picked = 0;
+        double seconds = 0.0;
+        for (int i = 0; i < count; i++) {
+            const Verdict& verdict = verdicts[i];
+            bool winnable = verdict.winRate > 0.0;
+            bool inBand = winnable && verdict.percentile >= options.bandLow && verdict.percentile <= options.bandHigh;
+            if (inBand) picked++;
+            seconds += verdict.seconds;
+            LOG_INFO(Log::Game, "  #%-3d seed %20llu: %5.1f%% wins, %5.2f HP lost per run, difficulty p%3.0f (%.2f s)%s", i,
+                (unsigned long long)verdict.seed, verdict.winRate * 100.0, verdict.hpLost, verdict.percentile, verdict.seconds,
+                !winnable ? " - not winnable" : inBand ? " - picked" : "");
+        }
+        LOG_INFO(Log::Game, "Picked %d of %d seeds in %.1f s; play one with --daily <seed>", picked, count, seconds);
+        return picked > 0 ? 0 : 1;
     }
 };
-class Map {
-private:
-    RenderWindow& window;
-    Player& player;
-    Deck& deck;
 
-    struct Node {
-        Vector2f position;
-        int type; // 0=battle, 1=shop, 2=refill
-        bool active;
-        bool visited;
-        Sprite sprite;
+// N independent battles stepped in lockstep for policy training, on the same
+// card rules as Battle. Per-environment state is kept field by field (structure
+// of arrays); a card play gathers one environment into a BattleState, runs
+// CardLibrary::play on it and scatters it back. step() writes into buffers the
+// caller owns and never allocates. One VecEnv per thread; it isn't shared.
+//
+// An action is a hand slot and an enemy index; slot END_TURN (or any slot
+// out of range) ends the turn. Plays the rules refuse (empty slot, too little
+// mana, a once-per-battle card already used) do nothing, and the observation's
+// playable flags show which slots can be played. A finished battle resets in
+// place, so the observation written with done set is the next battle's first.
+class VecEnv {
+public:
+    struct Options {
+        int node;    // Map node the fights are drawn from; -1 for a random battle node
+        int maxHP;
+        int maxMana;
     };
 
-    vector<Node> nodes;
-    int currentNode;
-    vector<int> currentOptions;
+    struct Action {
+        Int32 slot;   // Hand index, or END_TURN
+        Int32 target; // Enemy index; ignored by untargeted cards
+    };
 
-    Texture nodeTextures[3];
-    Texture bgTexture;
-    Sprite background;
-    Font font;
+    static const int END_TURN = -1;
+    static const int HAND_SIZE = TurnSolver::HAND_SIZE;
+    static const int MAX_ENEMIES = BattleState::MAX_ENEMIES;
+
+    // Observation layout, in floats per environment
+    enum Observation {
+        OBS_HP, OBS_MAX_HP, OBS_MANA, OBS_MAX_MANA, OBS_POWER, OBS_TURN, OBS_DECK,
+        OBS_HAND,                                  // Card id per slot, -1 when empty
+        OBS_PLAYABLE = OBS_HAND + HAND_SIZE,       // 1 when the slot can be paid for
+        OBS_ENEMY_HP = OBS_PLAYABLE + HAND_SIZE,
+        OBS_ENEMY_TYPE = OBS_ENEMY_HP + MAX_ENEMIES,
+        OBS_ENEMY_ALIVE = OBS_ENEMY_TYPE + MAX_ENEMIES,
+        OBS_ENEMY_EXHAUST = OBS_ENEMY_ALIVE + MAX_ENEMIES,
+        OBS_SIZE = OBS_ENEMY_EXHAUST + MAX_ENEMIES
+    };
 
-    Text headerText;
-    Text nodeInfoText;
-    Text healthText;
-    RectangleShape healthBox;
+    // Rewards: +1 for a win, -1 for a loss or timeout, plus 0.01 per point of
+    // enemy HP removed and -0.01 per point of damage taken on the way.
+    static const int MAX_TURNS = 50; // As in RunSimulator
+    static const int MAX_STEPS = 400; // Caps episodes of refused plays
+
+private:
+    static const int DECK_CAPACITY = 32; // Ring per environment; power of two, at least Deck's limit
+    static const int STATUS_FIELDS = BattleState::STATUS_COUNT * BattleState::ENTITIES;
+
+    int count;
+    Options options;
+    vector<int> cardLevels; // Shared by every environment
+    vector<int> cardCosts;
+    vector<int> starterCards;
+    int deckLimit;
+
+    // Player and battle
+    vector<Int32> playerHP;
+    vector<Int32> mana;
+    vector<Int32> turn;
+    vector<Int32> steps;
+    vector<Int32> enemyCount;
+    vector<Uint32> usedOnce;
+
+    // MAX_ENEMIES per environment
+    vector<Int32> enemyHP;
+    vector<Int32> enemyType;
+    vector<Uint8> enemyAlive;
+
+    // STATUS_COUNT per environment, then STATUS_FIELDS per environment
+    vector<Uint32> statusActive;
+    vector<Int32> statusValue;
+    vector<Int32> statusTurns;
+
+    // HAND_SIZE per environment, and each deck as a ring with the bottom at head
+    vector<Int32> hand;
+    vector<Int32> deckCards;
+    vector<Int32> deckHead;
+    vector<Int32> deckSize;
+
+    vector<Random> randoms;
+
+    void gather(int env, BattleState& state) const {
+        state.playerHP = playerHP[env];
+        state.playerMaxHP = options.maxHP;
+        state.enemyCount = enemyCount[env];
+        for (int i = 0; i < MAX_ENEMIES; i++) {
+            state.enemyHP[i] = enemyHP[env * MAX_ENEMIES + i];
+            state.enemyType[i] = enemyType[env * MAX_ENEMIES + i];
+            state.enemyAlive[i] = enemyAlive[env * MAX_ENEMIES + i] != 0;
+        }
+        state.usedOnce = usedOnce[env];
+        for (int s = 0; s < BattleState::STATUS_COUNT; s++) {
+            state.statusActive[s] = statusActive[env * BattleState::STATUS_COUNT + s];
+            for (int e = 0; e < BattleState::ENTITIES; e++) {
+                int field = env * STATUS_FIELDS + s * BattleState::ENTITIES + e;
+                state.statusValue[s][e] = statusValue[field];
+                state.statusTurns[s][e] = statusTurns[field];
+            }
+        }
+    }
+
+    void scatter(int env, const BattleState& state) {
+        playerHP[env] = state.playerHP;
+        enemyCount[env] = state.enemyCount;
+        for (int i = 0; i < MAX_ENEMIES; i++) {
+            enemyHP[env * MAX_ENEMIES + i] = state.enemyHP[i];
+            enemyType[env * MAX_ENEMIES + i] = state.enemyType[i];
+            enemyAlive[env * MAX_ENEMIES + i] = state.enemyAlive[i] ? 1 : 0;
+        }
+        usedOnce[env] = state.usedOnce;
+        for (int s = 0; s < BattleState::STATUS_COUNT; s++) {
+            statusActive[env * BattleState::STATUS_COUNT + s] = state.statusActive[s];
+            for (int e = 0; e < BattleState::ENTITIES; e++) {
+                int field = env * STATUS_FIELDS + s * BattleState::ENTITIES + e;
+                statusValue[field] = state.statusValue[s][e];
+                statusTurns[field] = state.statusTurns[s][e];
+            }
+        }
+    }
 
-    const float NODE_SCALE = 0.3f;
-    const Color VISITED_COLOR = Color(150, 150, 150, 200);
-    const Color ACTIVE_COLOR = Color::White;
-    const Color INACTIVE_COLOR = Color(100, 100, 100, 150);
+    // Same order as Deck: draw from the top, discard to the bottom.
+    int draw(int env) {
+        if (deckSize[env] == 0) return -1;
+        int top = (deckHead[env] + --deckSize[env]) & (DECK_CAPACITY - 1);
+        return deckCards[env * DECK_CAPACITY + top];
+    }
 
-    void setupNodes() {
-        nodes.push_back({
-            Vector2f(100, 360), 0, true, false,
-            Sprite(nodeTextures[0])
-            });
-
-        float secondColX = 250;
-        nodes.push_back({
-            Vector2f(secondColX, 200), 1, false, false,
-            Sprite(nodeTextures[1])
-            });
-        nodes.push_back({
-            Vector2f(secondColX, 520), 0, false, false,
-            Sprite(nodeTextures[0])
-            });
-
-        nodes.push_back({
-            Vector2f(400, 360), 0, false, false,
-            Sprite(nodeTextures[0])
-            });
-
-        float fourthColX = 550;
-        nodes.push_back({
-            Vector2f(fourthColX, 200), 0, false, false,
-            Sprite(nodeTextures[0])
-            });
-        nodes.push_back({
-            Vector2f(fourthColX, 520), 1, false, false,
-            Sprite(nodeTextures[1])
-            });
-
-        float fifthColX = 700;
-        nodes.push_back({
-            Vector2f(fifthColX, 250), 1, false, false,
-            Sprite(nodeTextures[1])
-            });
-        nodes.push_back({
-            Vector2f(fifthColX, 470), 2, false, false,
-            Sprite(nodeTextures[2])
-            });
-
-        nodes.push_back({
-            Vector2f(1000, 360), 0, false, false,
-            Sprite(nodeTextures[0])
-            });
+    void discard(int env, int card) {
+        if (deckSize[env] >= deckLimit) return;
+        deckHead[env] = (deckHead[env] - 1) & (DECK_CAPACITY - 1);
+        deckCards[env * DECK_CAPACITY + deckHead[env]] = card;
+        deckSize[env]++;
+    }
 
-        for (auto& node : nodes) {
-            node.sprite.setScale(NODE_SCALE, NODE_SCALE);
-            node.sprite.setPosition(node.position);
-            node.sprite.setOrigin(node.sprite.getLocalBounds().width / 2,
-                node.sprite.getLocalBounds().height / 2);
+    void fillHand(int env) {
+        for (int i = 0; i < HAND_SIZE; i++) {
+            int& card = hand[env * HAND_SIZE + i];
+            if (card >= 0) discard(env, card);
+            card = draw(env);
         }
     }
 
-    void setupUI() {
-        headerText.setFont(font);
-        headerText.setString("MAGICKA");
-        headerText.setCharacterSize(48);
-        headerText.setPosition(640 - headerText.getLocalBounds().width / 2, 20);
+    void resetEnv(int env) {
+        Random& random = randoms[env];
+        int node = options.node;
+        while (node < 0 || MapGraph::type(node) != MapGraph::BATTLE) {
+            node = random.below(MapGraph::NODE_COUNT);
+        }
 
-        nodeInfoText.setFont(font);
-        nodeInfoText.setCharacterSize(24);
-        nodeInfoText.setPosition(20, 650);
+        BattleState state = BattleState();
+        state.playerHP = options.maxHP;
+        state.playerMaxHP = options.maxHP;
+        state.spawnEnemies(node, random);
+        scatter(env, state);
+        mana[env] = options.maxMana;
+        turn[env] = 1;
+        steps[env] = 0;
+
+        // A freshly shuffled starter deck (Fisher-Yates, as Random::shuffle)
+        Int32* cards = &deckCards[env * DECK_CAPACITY];
+        int size = (int)starterCards.size();
+        for (int i = 0; i < size; i++) cards[i] = starterCards[i];
+        for (int i = size - 1; i > 0; i--) swap(cards[i], cards[random.below(i + 1)]);
+        deckHead[env] = 0;
+        deckSize[env] = size;
+        for (int i = 0; i < HAND_SIZE; i++) hand[env * HAND_SIZE + i] = -1;
+        fillHand(env);
+    }
 
-        healthBox.setSize(Vector2f(200, 30));
-        healthBox.setPosition(1060, 650);
-        healthBox.setFillColor(Color(50, 50, 50, 200));
+    // Enemies attack in order, then the next player turn starts. Returns damage taken.
+    int enemyTurn(int env) {
+        BattleState state;
+        gather(env, state);
+        int before = state.playerHP;
+        for (int i = 0; i < state.enemyCount && state.playerHP > 0; i++) {
+            if (state.enemyAlive[i]) state.playerHP -= state.enemyDamage(i, BattleState::rollAttack(state.enemyType[i], randoms[env]));
+        }
+        int taken = before - state.playerHP;
+        if (state.playerHP > 0) {
+            state.tickStatuses();
+            mana[env] = options.maxMana;
+            turn[env]++;
+        }
+        scatter(env, state);
+        if (playerHP[env] > 0) fillHand(env);
+        return taken;
+    }
 
-        healthText.setFont(font);
-        healthText.setCharacterSize(24);
-        healthText.setPosition(1070, 650);
-        updateHealthDisplay();
+    int enemiesLeft(int env) const {
+        int alive = 0;
+        for (int i = 0; i < enemyCount[env]; i++) alive += enemyAlive[env * MAX_ENEMIES + i];
+        return alive;
     }
 
-    void updateHealthDisplay() {
-        float healthPercent = (float)player.getHP() / player.getMaxHP();
+    void observe(int env, float* out) const {
+        const Int32* envHand = &hand[env * HAND_SIZE];
+        out[OBS_HP] = (float)playerHP[env];
+        out[OBS_MAX_HP] = (float)options.maxHP;
+        out[OBS_MANA] = (float)mana[env];
+        out[OBS_MAX_MANA] = (float)options.maxMana;
+        bool powered = statusActive[env * BattleState::STATUS_COUNT + BattleState::POWER] & 1u;
+        out[OBS_POWER] = powered ? (float)statusValue[env * STATUS_FIELDS + BattleState::POWER * BattleState::ENTITIES] : 0.f;
+        out[OBS_TURN] = (float)turn[env];
+        out[OBS_DECK] = (float)deckSize[env];
+        for (int i = 0; i < HAND_SIZE; i++) {
+            out[OBS_HAND + i] = (float)envHand[i];
+            out[OBS_PLAYABLE + i] = envHand[i] >= 0 && cardCosts[envHand[i]] <= mana[env] ? 1.f : 0.f;
+        }
+        unsigned exhausted = statusActive[env * BattleState::STATUS_COUNT + BattleState::EXHAUST];
+        for (int i = 0; i < MAX_ENEMIES; i++) {
+            int slot = env * MAX_ENEMIES + i;
+            bool present = i < enemyCount[env];
+            out[OBS_ENEMY_HP + i] = present ? (float)max(0, enemyHP[slot]) : 0.f;
+            out[OBS_ENEMY_TYPE + i] = present ? (float)enemyType[slot] : -1.f;
+            out[OBS_ENEMY_ALIVE + i] = present && enemyAlive[slot] ? 1.f : 0.f;
+            out[OBS_ENEMY_EXHAUST + i] = (exhausted >> (1 + i) & 1u)
+                ? (float)statusValue[env * STATUS_FIELDS + BattleState::EXHAUST * BattleState::ENTITIES + 1 + i] : 0.f;
+        }
+    }
 
-        if (healthPercent > 0.75f) {
-            healthText.setFillColor(Color::Green);
+public:
+    VecEnv(int environments, Uint64 seed, const Options& settings) : count(max(1, environments)), options(settings) {
+        if (options.node < -1 || options.node >= MapGraph::NODE_COUNT) options.node = -1; // Random battle node
+        const CardLibrary& library = CardLibrary::instance();
+        Random ordering(seed);
+        Deck starter(ordering);
+        for (int id = 0; id < library.count(); id++) {
+            cardLevels.push_back(starter.getLevel(id));
+            cardCosts.push_back(library.get(id).cost);
         }
-        else if (healthPercent > 0.25f) {
-            healthText.setFillColor(Color(255, 165, 0));
+        for (int i = 0; i < starter.getCardCount(); i++) {
+            starterCards.push_back(starter.getCard(i));
         }
-        else {
-            healthText.setFillColor(Color::Red);
+        deckLimit = min(starter.getMaxCards(), (int)DECK_CAPACITY);
+
+        playerHP.assign(count, 0);
+        mana.assign(count, 0);
+        turn.assign(count, 0);
+        steps.assign(count, 0);
+        enemyCount.assign(count, 0);
+        usedOnce.assign(count, 0);
+        enemyHP.assign(count * MAX_ENEMIES, 0);
+        enemyType.assign(count * MAX_ENEMIES, 0);
+        enemyAlive.assign(count * MAX_ENEMIES, 0);
+        statusActive.assign(count * BattleState::STATUS_COUNT, 0);
+        statusValue.assign(count * STATUS_FIELDS, 0);
+        statusTurns.assign(count * STATUS_FIELDS, 0);
+        hand.assign(count * HAND_SIZE, -1);
+        deckCards.assign(count * DECK_CAPACITY, -1);
+        deckHead.assign(count, 0);
+        deckSize.assign(count, 0);
+        for (int env = 0; env < count; env++) {
+            randoms.push_back(Random(seed + (Uint64)env));
         }
+    }
 
-        healthText.setString("HP: " + to_string(player.getHP()) + "/" + to_string(player.getMaxHP()));
+    static Options defaults() {
+        Options settings = { -1, 25, 5 }; // Same as a new Player
+        return settings;
     }
 
-    void activateNextNodes(int chosenIndex) {
-        if (currentNode >= 0 && currentNode < nodes.size()) {
-            nodes[currentNode].visited = true;
-        }
+    int size() const { return count; }
 
-        for (auto& node : nodes) {
-            node.active = false;
+    // observations: size() * OBS_SIZE floats
+    void reset(float* observations) {
+        for (int env = 0; env < count; env++) {
+            resetEnv(env);
+            observe(env, observations + env * OBS_SIZE);
         }
+    }
 
-        currentNode = chosenIndex;
-        currentOptions.clear();
+    // actions: size() entries; observations: size() * OBS_SIZE; rewards and dones: size()
+    void step(const Action* actions, float* observations, float* rewards, Uint8* dones) {
+        const CardLibrary& library = CardLibrary::instance();
+        for (int env = 0; env < count; env++) {
+            float reward = 0.f;
+            bool done = false;
+            int slot = actions[env].slot;
+            steps[env]++;
+
+            if (slot >= 0 && slot < HAND_SIZE) {
+                int id = hand[env * HAND_SIZE + slot];
+                if (id >= 0 && cardCosts[id] <= mana[env]) {
+                    BattleState state;
+                    gather(env, state);
+                    int before = 0, after = 0;
+                    for (int i = 0; i < state.enemyCount; i++) before += max(0, state.enemyHP[i]);
+                    if (library.play(id, cardLevels[id], state, actions[env].target)) {
+                        for (int i = 0; i < state.enemyCount; i++) after += max(0, state.enemyHP[i]);
+                        reward += 0.01f * (before - after);
+                        scatter(env, state);
+                        mana[env] -= cardCosts[id];
+                        hand[env * HAND_SIZE + slot] = -1;
+                        discard(env, id);
+                    }
+                }
+                if (enemiesLeft(env) == 0) {
+                    reward += 1.f;
+                    done = true;
+                }
+            }
+            else {
+                reward -= 0.01f * enemyTurn(env);
+                if (playerHP[env] <= 0 || turn[env] > MAX_TURNS) {
+                    reward -= 1.f;
+                    done = true;
+                }
+            }
+            if (!done && steps[env] >= MAX_STEPS) {
+                reward -= 1.f;
+                done = true;
+            }
 
-        switch (chosenIndex) {
-        case 0:
-            nodes[1].active = true;
-            nodes[2].active = true;
-            currentOptions = { 1, 2 };
-            updateNodeText(2);
-            break;
-        case 1:
-        case 2:
-            nodes[3].active = true;
-            currentOptions = { 3 };
-            updateNodeText(1);
-            break;
-        case 3:
-            nodes[4].active = true;
-            nodes[5].active = true;
-            currentOptions = { 4, 5 };
-            updateNodeText(2);
-            break;
-        case 4:
-        case 5:
-            nodes[6].active = true;
-            nodes[7].active = true;
-            currentOptions = { 6, 7 };
-            updateNodeText(2);
-            break;
-        case 6:
-        case 7:
-            nodes[8].active = true;
-            currentOptions = { 8 };
-            updateNodeText(1);
-            break;
-        default:
-            nodes[0].active = true;
-            currentOptions = { 0 };
-            updateNodeText(1);
-            break;
+            if (done) resetEnv(env);
+            rewards[env] = reward;
+            dones[env] = done ? 1 : 0;
+            observe(env, observations + env * OBS_SIZE);
         }
     }
 
-    void updateNodeText(int optionsCount) {
-        if (optionsCount == 1) {
-            string state;
-            switch (nodes[currentOptions[0]].type) {
-            case 0: state = "Battle"; break;
-            case 1: state = "Shop"; break;
-            case 2: state = "Refill Health"; break;
+    // Random legal-ish policy for --env-bench: plays an affordable card when it can.
+    static void randomActions(const float* observations, int environments, Random& random, Action* actions) {
+        for (int env = 0; env < environments; env++) {
+            const float* obs = observations + env * OBS_SIZE;
+            int slot = END_TURN;
+            int start = random.below(HAND_SIZE);
+            for (int i = 0; i < HAND_SIZE && slot == END_TURN; i++) {
+                int candidate = (start + i) % HAND_SIZE;
+                if (obs[OBS_PLAYABLE + candidate] > 0.f) slot = candidate;
             }
-            nodeInfoText.setString("Press ENTER to enter " + state);
+            actions[env].slot = slot;
+            actions[env].target = random.below(MAX_ENEMIES);
         }
-        else if (optionsCount == 2) {
-            string state1, state2;
-            switch (nodes[currentOptions[0]].type) {
-            case 0: state1 = "Battle"; break;
-            case 1: state1 = "Shop"; break;
-            case 2: state1 = "Refill Health"; break;
-            }
-            switch (nodes[currentOptions[1]].type) {
-            case 0: state2 = "Battle"; break;
-            case 1: state2 = "Shop"; break;
-            case 2: state2 = "Refill Health"; break;
+    }
+
+    // Steps `environments` battles with random play for about `seconds` and logs the rate.
+    static int benchmark(int environments, double seconds) {
+        VecEnv env(environments, 1, defaults());
+        vector<float> observations((size_t)env.size() * OBS_SIZE);
+        vector<float> rewards(env.size());
+        vector<Uint8> dones(env.size());
+        vector<Action> actions(env.size());
+        Random random(7);
+        env.reset(&observations[0]);
+
+        Uint64 stepsTaken = 0, episodes = 0, wins = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        double elapsed = 0.0;
+        while (elapsed < seconds) {
+            for (int batch = 0; batch < 64; batch++) {
+                randomActions(&observations[0], env.size(), random, &actions[0]);
+                env.step(&actions[0], &observations[0], &rewards[0], &dones[0]);
+                for (int i = 0; i < env.size(); i++) {
+                    episodes += dones[i];
+                    wins += dones[i] && rewards[i] > 0.5f;
+                }
+                stepsTaken += env.size();
             }
-            nodeInfoText.setString("Press 1 for " + state1 + "\nPress 2 for " + state2);
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
         }
+        LOG_INFO(Log::Game, "VecEnv: %d environments, %.2f M steps/s, %llu episodes (%.1f%% won by random play)",
+            env.size(), stepsTaken / elapsed / 1e6, (unsigned long long)episodes, episodes ? 100.0 * wins / episodes : 0.0);
+        return 0;
     }
+};
 
-    void handleNodeSelection(int optionIndex) {
-        if (optionIndex < 0 || optionIndex >= currentOptions.size()) return;
+// C entry points for training code (ctypes, cffi). Build the file as a shared
+// library with MAGICKA_LIBRARY defined to leave out main(). actions holds two
+// int32 per environment (slot, target), see VecEnv.
+
+// A library build has no main() to run the log drain, so the first create
+// starts it on stderr, and exit stops it with whatever is left written out.
+static void startLibraryLog() {
+    static atomic<bool> started(false);
+    if (started.exchange(true)) return;
+    Log::start();
+    atexit(Log::stop);
+}
+
+extern "C" {
+    // NULL if cards.txt or encounters.txt can't be loaded; the log says why. An
+    // unknown node draws from random battle nodes.
+    void* magicka_env_create(int environments, unsigned long long seed, int node) {
+        startLibraryLog();
+        if (CardLibrary::instance().count() == 0 && !loadRuleFiles()) return nullptr;
+        VecEnv::Options options = VecEnv::defaults();
+        options.node = node;
+        return new VecEnv(environments, seed, options);
+    }
 
-        int nodeIndex = currentOptions[optionIndex];
-        if (!nodes[nodeIndex].active) return;
+    void magicka_env_destroy(void* env) {
+        delete (VecEnv*)env;
+    }
 
-        switch (nodes[nodeIndex].type) {
-        case 0: {
-            Battle battle(player, deck, currentNode, window);
-            bool battleWon = battle.run();
-            if (!player.isAlive()) {
-                return; // Player died, handle in run()
-            }
-            if (battleWon) {
-                activateNextNodes(nodeIndex);
-            }
-            break;
-        }
-        case 1: {
-            Shop shop;
-            shop.run(player, deck, window);
-            activateNextNodes(nodeIndex);
-            break;
-        }
-        case 2: {
-            player.heal(player.getMaxHP() - player.getHP());
-            activateNextNodes(nodeIndex);
-            break;
-        }
-        }
-        updateHealthDisplay();
+    int magicka_env_observation_size(void) {
+        return VecEnv::OBS_SIZE;
     }
 
-    void render() {
-        window.clear();
-        window.draw(background);
+    void magicka_env_reset(void* env, float* observations) {
+        ((VecEnv*)env)->reset(observations);
+    }
 
-        for (auto& node : nodes) {
-            if (node.visited) {
-                node.sprite.setColor(VISITED_COLOR);
-            }
-            else if (node.active) {
-                node.sprite.setColor(ACTIVE_COLOR);
-            }
-            else {
-                node.sprite.setColor(INACTIVE_COLOR);
-            }
-            window.draw(node.sprite);
-        }
+    void magicka_env_step(void* env, const int* actions, float* observations, float* rewards, unsigned char* dones) {
+        ((VecEnv*)env)->step((const VecEnv::Action*)actions, observations, rewards, dones);
+    }
+}
+
+// End-of-run screens. They share the title screen's font.
+class Victory : public Scene {
+private:
+    Text victoryText;
+    Text promptText;
 
-        window.draw(headerText);
-        window.draw(healthBox);
-        window.draw(healthText);
-        window.draw(nodeInfoText);
+public:
+    explicit Victory(const Font& font) {
+        victoryText.setFont(font);
+        victoryText.setString("VICTORY");
+        victoryText.setCharacterSize(72);
+        victoryText.setFillColor(Color::Green);
+        victoryText.setPosition(640 - victoryText.getLocalBounds().width / 2, 360 - victoryText.getLocalBounds().height / 2);
 
-        window.display();
+        promptText.setFont(font);
+        promptText.setString("Press ENTER to Play Again");
+        promptText.setCharacterSize(24);
+        promptText.setFillColor(Color::White);
+        promptText.setPosition(640 - promptText.getLocalBounds().width / 2, 450);
     }
 
-public:
-    Map(RenderWindow& w, Player& p, Deck& d) : window(w), player(p), deck(d), currentNode(-1) {
-        if (!font.loadFromFile("Fonts/American Captain.ttf")) {
-            cerr << "Critical: No fonts available!" << endl;
-        }
+    void handleInput(const InputSystem::Input& input) override {
+        if (input.action == InputSystem::CONFIRM) finish();
+    }
 
-        if (!nodeTextures[0].loadFromFile("Images/Map/iconbat.png") ||
-            !nodeTextures[1].loadFromFile("Images/Map/iconshop.png") ||
-            !nodeTextures[2].loadFromFile("Images/Map/health_refill.png") ||
-            !bgTexture.loadFromFile("Images/Map/map_bg.png")) {
-            cerr << "Failed to load map resources!" << endl;
-        }
-        background.setTexture(bgTexture);
+    void tick(float dt) override {}
+    const char* sceneName() const override { return "Victory"; }
 
-        setupNodes();
-        setupUI();
-        activateNextNodes(-1);
+    void buildFrame(RenderSnapshot& frame) override {
+        frame.clear(Color::Black);
+        frame.draw(victoryText);
+        frame.draw(promptText);
     }
+};
 
-    ~Map() {}
+class Defeat : public Scene {
+private:
+    Text defeatText;
+    Text restartText;
 
-    int getCurrentNode() const { return currentNode; }
+public:
+    explicit Defeat(const Font& font) {
+        defeatText.setFont(font);
+        defeatText.setString("DEFEAT");
+        defeatText.setCharacterSize(72);
+        defeatText.setFillColor(Color::Red);
+        defeatText.setPosition(640 - defeatText.getLocalBounds().width / 2, 360 - defeatText.getLocalBounds().height / 2);
 
-    int run() {
-        while (window.isOpen()) {
-            Event event;
-            while (window.pollEvent(event)) {
-                if (event.type == Event::Closed) {
-                    window.close();
-                    return 0;
-                }
+        restartText.setFont(font);
+        restartText.setString("Press 1 to Restart");
+        restartText.setCharacterSize(24);
+        restartText.setFillColor(Color::White);
+        restartText.setPosition(640 - restartText.getLocalBounds().width / 2, 450);
+    }
 
-                if (event.type == Event::KeyPressed) {
-                    if (event.key.code == Keyboard::Enter && currentOptions.size() == 1) {
-                        handleNodeSelection(0);
-                        if (!player.isAlive()) {
-                            return 2; // Defeat
-                        }
-                        if (currentNode == 8 && currentOptions.size() == 0) {
-                            return 1; // Victory (Blue node battle won, no more options)
-                        }
-                    }
-                    else if (event.key.code == Keyboard::Num1 && currentOptions.size() >= 1) {
-                        handleNodeSelection(0);
-                        if (!player.isAlive()) {
-                            return 2; // Defeat
-                        }
-                        if (currentNode == 8 && currentOptions.size() == 0) {
-                            return 1; // Victory
-                        }
-                    }
-                    else if (event.key.code == Keyboard::Num2 && currentOptions.size() >= 2) {
-                        handleNodeSelection(1);
-                        if (!player.isAlive()) {
-                            return 2; // Defeat
-                        }
-                        if (currentNode == 8 && currentOptions.size() == 0) {
-                            return 1; // Victory
-                        }
-                    }
-                }
-            }
+    void handleInput(const InputSystem::Input& input) override {
+        if (input.action == InputSystem::SELECT && input.slot == 0) finish();
+    }
 
-            render();
-        }
-        return 0;
+    void tick(float dt) override {}
+    const char* sceneName() const override { return "Defeat"; }
+
+    void buildFrame(RenderSnapshot& frame) override {
+        frame.clear(Color::Black);
+        frame.draw(defeatText);
+        frame.draw(restartText);
     }
 };
 
-class Game {
+// Owns the window, the renderer and every scene, and is itself the title
+// screen at the bottom of the scene stack.
+class Game : public Scene {
 private:
+    static const int FRAMERATE_CAP = 240; // Above common refresh rates, so vsync still sets the pace
+
     RenderWindow window;
-    Player player;
-    Deck deck;
+    Renderer renderer;
+    SceneStack scenes;
+    Player* player;
+    Deck* deck;
+    Battle* battle;
+    Shop* shop;
     Map* map;
+    Victory* victory;
+    Defeat* defeat;
 
     Font font;
     Text titleText;
     Text madeByText;
     Text pressEnterText;
-    Text victoryText;
-    Text victoryPromptText;
-    Text defeatText;
-    Text defeatOption1Text;
 
-    enum GameState {
-        TITLE,
-        MAP,
-        VICTORY,
-        DEFEAT
+    // Everything past the title screen is built one step per tick once the
+    // title has been presented, so the window shows up before any art loads.
+    enum WarmupStep {
+        WARM_HUD_FONT,
+        WARM_CARDS,
+        WARM_PLAYER,
+        WARM_CARD_ART,
+        WARM_DECK,
+        WARM_SCENES,
+        WARM_ROUTES,
+        WARM_MAP,
+        WARM_DONE
     };
-    GameState currentState;
-    int lastNode;
+    int warmupStep;
 
     void setupUI() {
-        if (!font.loadFromFile("Fonts/American Captain.ttf")) {
-            cerr << "Critical: No fonts available!" << endl;
+        if (!TextureLoader::tryLoadFont(font, "Fonts/American Captain.ttf")) {
+            LOG_ERROR(Log::Assets, "Critical: No fonts available!");
         }
 
         titleText.setFont(font);
@@ -1514,141 +6937,304 @@ private:
         pressEnterText.setCharacterSize(24);
         pressEnterText.setFillColor(Color::White);
         pressEnterText.setPosition(640 - pressEnterText.getLocalBounds().width / 2, 420);
+    }
 
-        victoryText.setFont(font);
-        victoryText.setString("VICTORY");
-        victoryText.setCharacterSize(72);
-        victoryText.setFillColor(Color::Green);
-        victoryText.setPosition(640 - victoryText.getLocalBounds().width / 2, 360 - victoryText.getLocalBounds().height / 2);
-
-        victoryPromptText.setFont(font);
-        victoryPromptText.setString("Press ENTER to Play Again");
-        victoryPromptText.setCharacterSize(24);
-        victoryPromptText.setFillColor(Color::White);
-        victoryPromptText.setPosition(640 - victoryPromptText.getLocalBounds().width / 2, 450);
-
-        defeatText.setFont(font);
-        defeatText.setString("DEFEAT");
-        defeatText.setCharacterSize(72);
-        defeatText.setFillColor(Color::Red);
-        defeatText.setPosition(640 - defeatText.getLocalBounds().width / 2, 360 - defeatText.getLocalBounds().height / 2);
+    void warmUp() {
+        switch (warmupStep) {
+        case WARM_HUD_FONT:
+            HudFont::instance().build("Fonts/American Captain.ttf");
+            StartupTrace::phase("hud font");
+            break;
+        case WARM_CARDS:
+            if (!loadRuleFiles()) {
+                LOG_ERROR(Log::Game, "Cannot start without the rule files");
+                finish(); // Empties the stack, which closes the game
+                warmupStep = WARM_DONE;
+                return;
+            }
+            StartupTrace::phase("cards");
+            break;
+        case WARM_PLAYER:
+            TextureCache::instance().load(TextureCache::Batch()
+                .add("player standing.png", TextureCache::CHARACTERS)
+                .add("player dying.png", TextureCache::CHARACTERS));
+            player = new Player();
+            StartupTrace::phase("player");
+            break;
+        case WARM_CARD_ART: {
+            TextureCache::Batch batch;
+            for (int id = 0; id < CardLibrary::instance().count(); id++) {
+                CardArt::request(batch, CardLibrary::instance().get(id).art, CardArt::THUMBNAIL);
+            }
+            TextureCache::instance().load(batch);
+            StartupTrace::phase("card art");
+            break;
+        }
+        case WARM_DECK:
+            deck = new Deck(Random::local());
+            StartupTrace::phase("deck");
+            break;
+        case WARM_SCENES:
+            battle = new Battle(*player, *deck);
+            shop = new Shop(*player, *deck);
+            victory = new Victory(font);
+            defeat = new Defeat(font);
+            StartupTrace::phase("scenes");
+            break;
+        case WARM_ROUTES:
+            RouteAdvisor::instance().prepare(player->getMaxHP());
+            StartupTrace::phase("routes");
+            break;
+        case WARM_MAP:
+            map = new Map(*player, *battle, *shop);
+            StartupTrace::phase("map");
+            StartupTrace::interactive();
+            break;
+        }
+        if (warmupStep < WARM_DONE) warmupStep++;
+    }
 
-        defeatOption1Text.setFont(font);
-        defeatOption1Text.setString("Press 1 to Restart");
-        defeatOption1Text.setCharacterSize(24);
-        defeatOption1Text.setFillColor(Color::White);
-        defeatOption1Text.setPosition(640 - defeatOption1Text.getLocalBounds().width / 2, 450);
+    // The title hands over to the map. A daily reseeds here, after warm-up has
+    // finished with the generator, and deals the starter deck from its stream.
+    void beginRun() {
+        if (!DailyChallenge::instance().isActive()) return;
+        DailyChallenge::instance().start();
+        *deck = Deck(Random::local());
     }
 
+    // Fresh run: every scene object is kept and reset in place.
     void resetGame() {
-        player = Player();
-        deck = Deck();
-        delete map;
-        map = new Map(window, player, deck);
-        lastNode = -1;
+        player->reset();
+        *deck = Deck(Random::local());
+        map->reset();
+    }
+
+    void handleInput(const InputSystem::Input& input) override {
+        if (input.action == InputSystem::CONFIRM) {
+            while (warmupStep != WARM_DONE) warmUp();
+            if (!map) return;
+            beginRun();
+            stack->push(*map);
+        }
     }
 
-    void render() {
-        window.clear(Color::Black);
+    void resume(Scene& finishedScene, int finishedResult) override {
+        if (&finishedScene == map) {
+            if (finishedResult == Map::VICTORY) stack->push(*victory);
+            else if (finishedResult == Map::DEFEAT) stack->push(*defeat);
+        }
+        else if (&finishedScene == victory) {
+            resetGame(); // Back to the title screen
+        }
+        else if (&finishedScene == defeat) {
+            player->heal(player->getMaxHP());
+            stack->push(*map);
+        }
+    }
 
-        switch (currentState) {
-        case TITLE:
-            window.draw(titleText);
-            window.draw(madeByText);
-            window.draw(pressEnterText);
-            break;
-        case VICTORY:
-            window.draw(victoryText);
-            window.draw(victoryPromptText);
-            break;
-        case DEFEAT:
-            window.draw(defeatText);
-            window.draw(defeatOption1Text);
-            break;
-        case MAP:
-            break;
+    void tick(float dt) override {
+        if (warmupStep != WARM_DONE && StartupTrace::hasFirstFrame()) {
+            warmUp();
         }
+    }
 
-        window.display();
+    const char* sceneName() const override { return "Title"; }
+
+    void buildFrame(RenderSnapshot& frame) override {
+        frame.clear(Color::Black);
+        frame.draw(titleText);
+        frame.draw(madeByText);
+        frame.draw(pressEnterText);
     }
 
 public:
-    Game() : window(VideoMode(1280, 720), "Magicka - The Roguelike Deckbuilder"), currentState(TITLE), lastNode(-1) {
-        window.setFramerateLimit(60);
-        map = new Map(window, player, deck);
+    Game() : window(VideoMode(1280, 720), "Magicka - The Roguelike Deckbuilder"), renderer(window), scenes(renderer),
+        player(nullptr), deck(nullptr), battle(nullptr), shop(nullptr), map(nullptr), victory(nullptr), defeat(nullptr),
+        warmupStep(WARM_HUD_FONT) {
+        window.setVerticalSyncEnabled(true); // Render at display rate; logic runs on FixedTimestep
+        window.setFramerateLimit(FRAMERATE_CAP); // In case the driver ignores vsync or it is off
+        StartupTrace::phase("window");
         setupUI();
+        StartupTrace::phase("title");
     }
 
+    // Scenes hold textures the render thread may still be drawing, so it stops first.
     ~Game() {
+        renderer.stop();
+        scenes.clear();
         delete map;
+        delete defeat;
+        delete victory;
+        delete shop;
+        delete battle;
+        delete deck;
+        delete player;
     }
 
     void run() {
-        while (window.isOpen()) {
-            Event event;
-            while (window.pollEvent(event)) {
-                if (event.type == Event::Closed) {
-                    window.close();
-                    return;
-                }
+        renderer.start();
+        scenes.push(*this);
+        scenes.run();
+        renderer.stop();
+        window.close();
+    }
+};
 
-                if (event.type == Event::KeyPressed) {
-                    switch (currentState) {
-                    case TITLE:
-                        if (event.key.code == Keyboard::Enter) {
-                            currentState = MAP;
-                        }
-                        break;
-                    case MAP:
-                        break;
-                    case VICTORY:
-                        if (event.key.code == Keyboard::Enter) {
-                            resetGame();
-                            currentState = TITLE;
-                        }
-                        break;
-                    case DEFEAT:
-                        if (event.key.code == Keyboard::Num1) {
-                            player.heal(player.getMaxHP());
-                            delete map;
-                            map = new Map(window, player, deck);
-                            for (int i = -1; i < lastNode; i++) {
-                                map->run();
-                            }
-                            currentState = MAP;
-                        }
-                        break;
-                    }
-                }
-            }
+#ifdef MAGICKA_ALLOC_TRACKING
+// --alloc-check: idles a battle and then the map for a few seconds each and
+// fails if any steady frame touched the heap.
+class AllocCheck {
+private:
+    static const int FRAMES = 240;
 
-            switch (currentState) {
-            case TITLE:
-            case VICTORY:
-            case DEFEAT:
-                render();
-                break;
-            case MAP: {
-                int status = map->run();
-                if (status == 1) {
-                    currentState = VICTORY;
-                }
-                else if (status == 2) {
-                    lastNode = map->getCurrentNode();
-                    currentState = DEFEAT;
-                }
-                else if (status == 0) {
-                    return;
-                }
-                break;
-            }
-            }
+public:
+    static int run() {
+        RenderWindow window(VideoMode(1280, 720), "Magicka - allocation check");
+        Renderer renderer(window);
+        HudFont::instance().build("Fonts/American Captain.ttf");
+        if (!loadRuleFiles()) return 1;
+        Player player;
+        Deck deck(Random::local());
+        Battle battle(player, deck);
+        Shop shop(player, deck);
+        Map map(player, battle, shop);
+        SceneStack scenes(renderer);
+        scenes.limitFrames(FRAMES);
+
+        battle.begin(0);
+        scenes.push(battle);
+        scenes.run();
+        scenes.clear();
+        scenes.push(map);
+        scenes.run();
+        scenes.clear();
+
+        Uint64 frames = AllocTracker::steadyFramesThatAllocated();
+        if (frames) {
+            LOG_ERROR(Log::Game, "Allocation check failed: %llu steady frames allocated", (unsigned long long)frames);
+            return 1;
         }
+        LOG_INFO(Log::Game, "Allocation check passed: idle battle and map frames made no allocations");
+        return 0;
     }
 };
+#endif
+
+#ifndef MAGICKA_LIBRARY
+int main(int argc, char* argv[]) {
+    StartupTrace::begin();
+    string logPath;
+    string packOutput;
+    bool allocCheck = false;
+    int benchEnvironments = 0;
+    RunSimulator::Options simulation = { 0, (int)max(1u, thread::hardware_concurrency()), (Uint64)time(nullptr), TurnSolver::EXACT, "", 0 };
+    SeedVerifier::Options screening = { DailyChallenge::today(), 0, 2000, simulation.threads, 40.f, 60.f };
+    Uint64 dailySeed = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--log" && i + 1 < argc) {
+            logPath = argv[++i];
+        }
+        else if (arg == "--pack") {
+            packOutput = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : "assets.pak";
+        }
+        else if (arg == "--simulate" && i + 1 < argc) {
+            simulation.runs = atoi(argv[++i]);
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            simulation.threads = screening.threads = atoi(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            simulation.seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--greedy") {
+            simulation.policy = TurnSolver::GREEDY;
+        }
+        else if (arg == "--samples" && i + 1 < argc) {
+            simulation.samplesDirectory = argv[++i];
+        }
+        else if (arg == "--alloc-check") {
+            allocCheck = true;
+        }
+        else if (arg == "--env-bench" && i + 1 < argc) {
+            benchEnvironments = atoi(argv[++i]);
+        }
+        else if (arg == "--daily") {
+            bool published = i + 1 < argc && argv[i + 1][0] != '-';
+            dailySeed = published ? strtoull(argv[++i], nullptr, 10) : DailyChallenge::seedFor(DailyChallenge::today());
+        }
+        else if (arg == "--daily-screen" && i + 1 < argc) {
+            screening.candidates = atoi(argv[++i]);
+        }
+        else if (arg == "--date" && i + 1 < argc) {
+            screening.date = atoi(argv[++i]);
+        }
+        else if (arg == "--runs" && i + 1 < argc) {
+            screening.runs = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--band" && i + 2 < argc) {
+            screening.bandLow = (float)atof(argv[++i]);
+            screening.bandHigh = (float)atof(argv[++i]);
+        }
+        else if (arg == "--texture-budget" && i + 1 < argc) {
+            TextureCache::instance().setBudget((size_t)max(1, atoi(argv[++i])) << 20);
+        }
+    }
+    Log::start(logPath);
+
+    if (!packOutput.empty()) {
+        bool packed = AssetPacker::build(".", packOutput);
+        Log::stop();
+        return packed ? 0 : 1;
+    }
+
+    if (simulation.runs > 0) {
+        int result = loadRuleFiles() ? RunSimulator::run(simulation) : 1;
+        Log::stop();
+        return result;
+    }
+
+    if (screening.candidates > 0) {
+        int result = loadRuleFiles() ? SeedVerifier::screen(screening) : 1;
+        Log::stop();
+        return result;
+    }
+
+    if (benchEnvironments > 0) {
+        int result = loadRuleFiles() ? VecEnv::benchmark(benchEnvironments, 3.0) : 1;
+        Log::stop();
+        return result;
+    }
+
+    Random::local().reseed((Uint64)time(nullptr));
+    if (dailySeed) {
+        DailyChallenge::instance().select(dailySeed);
+        LOG_INFO(Log::Game, "Daily challenge, seed %llu", (unsigned long long)dailySeed);
+    }
+
+    AssetPack::instance().open("assets.pak");
+    StartupTrace::phase("asset pack");
+
+#ifdef MAGICKA_ALLOC_TRACKING
+    if (allocCheck) {
+        int result = AllocCheck::run();
+        Log::stop();
+        return result;
+    }
+#else
+    if (allocCheck) {
+        LOG_WARN(Log::Game, "--alloc-check needs a build with MAGICKA_ALLOC_TRACKING defined");
+    }
+#endif
+
+    {
+        Game game;
+        game.run();
+    }
+    InputSystem::instance().report();
+    TextureCache::instance().report();
 
-int main() {
-    Game game;
-    game.run();
+    Log::stop();
     return 0;
-}
\ No newline at end of file
+}
+#endif